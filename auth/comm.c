@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "auth.h"
+#include "comm.h"
+#include "log.h"
+#include "password-buffer.h"
+
+static char *shared = NULL;
+
+// Returns the number of bytes read, which is less than size only on EOF
+static ssize_t read_full(int fd, void *buf, size_t size) {
+	size_t offs = 0;
+	while (offs < size) {
+		ssize_t amt = read(fd, (uint8_t *)buf + offs, size - offs);
+		if (amt < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		} else if (amt == 0) {
+			break;
+		}
+		offs += (size_t)amt;
+	}
+	return offs;
+}
+
+bool comm_child_init(bool use_shared) {
+	if (fcntl(COMM_REQUEST_FD, F_GETFD) == -1 ||
+			fcntl(COMM_REPLY_FD, F_GETFD) == -1) {
+		return false;
+	}
+	if (use_shared) {
+		shared = password_buffer_map_shared(COMM_SHARED_FD, COMM_SHARED_SIZE);
+		close(COMM_SHARED_FD);
+		if (!shared) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static ssize_t read_shared_request(const struct comm_header *header,
+		struct comm_request *req, char **buf_ptr) {
+	struct comm_doorbell bell;
+	if (!shared || header->len != sizeof(bell) ||
+			read_full(COMM_REQUEST_FD, &bell, sizeof(bell)) != sizeof(bell)) {
+		swaylock_log(LOG_ERROR, "invalid shared pw request");
+		return -1;
+	}
+	// Only trust what's in bounds and terminated
+	size_t end = (size_t)bell.offset + bell.len;
+	if (bell.len == 0 || bell.len > COMM_MAX_PAYLOAD ||
+			end > COMM_SHARED_SIZE || shared[end - 1] != '\0') {
+		swaylock_log(LOG_ERROR, "invalid shared pw request (offset %u, "
+			"length %u)", bell.offset, bell.len);
+		return -1;
+	}
+	swaylock_log(LOG_DEBUG, "received shared pw check request %u",
+		header->id);
+
+	req->id = header->id;
+	req->shared = true;
+	clock_gettime(CLOCK_MONOTONIC, &req->received);
+	*buf_ptr = &shared[bell.offset];
+	return bell.len;
+}
+
+// Reads a NUL-terminated payload of header->len bytes into a password buffer
+static char *read_payload(const struct comm_header *header) {
+	size_t size = header->len;
+	char *buf = password_buffer_create(size);
+	if (!buf) {
+		return NULL;
+	}
+	if (read_full(COMM_REQUEST_FD, buf, size) != (ssize_t)size) {
+		swaylock_log_errno(LOG_ERROR, "failed to read pw");
+		password_buffer_destroy(buf, size);
+		return NULL;
+	}
+	buf[size - 1] = '\0';
+	return buf;
+}
+
+ssize_t read_comm_request(struct comm_request *req, char **buf_ptr) {
+	struct comm_header header;
+	while (true) {
+		ssize_t amt = read_full(COMM_REQUEST_FD, &header, sizeof(header));
+		if (amt == 0) {
+			return 0;
+		} else if (amt != sizeof(header)) {
+			swaylock_log_errno(LOG_ERROR, "read pw request");
+			return -1;
+		}
+		if (header.version != COMM_PROTOCOL_VERSION ||
+				header.type != COMM_WARM_UP || header.len != 0) {
+			break;
+		}
+		warm_up_pw_backend();
+	}
+	if (header.version == COMM_PROTOCOL_VERSION &&
+			header.type == COMM_AUTH_REQUEST_SHARED) {
+		return read_shared_request(&header, req, buf_ptr);
+	}
+	if (header.version != COMM_PROTOCOL_VERSION ||
+			header.type != COMM_AUTH_REQUEST ||
+			header.len == 0 || header.len > COMM_MAX_PAYLOAD) {
+		swaylock_log(LOG_ERROR, "invalid pw request (version %u, type %u, "
+			"length %u)", header.version, header.type, header.len);
+		return -1;
+	}
+	swaylock_log(LOG_DEBUG, "received pw check request %u", header.id);
+
+	char *buf = read_payload(&header);
+	if (!buf) {
+		return -1;
+	}
+	req->id = header.id;
+	req->shared = false;
+	clock_gettime(CLOCK_MONOTONIC, &req->received);
+	*buf_ptr = buf;
+	return header.len;
+}
+
+void release_comm_request(const struct comm_request *req, char *buf,
+		size_t size) {
+	// Shared slots are wiped by swaylock once it has the reply
+	if (!req->shared) {
+		password_buffer_destroy(buf, size);
+	}
+}
+
+char *read_comm_password_hash(size_t *size) {
+	struct comm_header header;
+	if (read_full(COMM_REQUEST_FD, &header, sizeof(header)) !=
+			sizeof(header)) {
+		swaylock_log_errno(LOG_ERROR, "failed to read password hash");
+		return NULL;
+	}
+	if (header.version != COMM_PROTOCOL_VERSION ||
+			header.type != COMM_PASSWORD_HASH ||
+			header.len == 0 || header.len > COMM_MAX_PAYLOAD) {
+		swaylock_log(LOG_ERROR, "invalid password hash (version %u, "
+			"type %u, length %u)", header.version, header.type, header.len);
+		return NULL;
+	}
+	*size = header.len;
+	return read_payload(&header);
+}
+
+bool write_comm_reply(const struct comm_request *req, bool success,
+		int32_t status) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t duration_ns = (int64_t)(now.tv_sec - req->received.tv_sec) *
+		1000000000 + (now.tv_nsec - req->received.tv_nsec);
+
+	struct comm_header header = {
+		.version = COMM_PROTOCOL_VERSION,
+		.type = COMM_AUTH_REPLY,
+		.id = req->id,
+		.len = sizeof(struct comm_reply_payload),
+	};
+	struct comm_reply_payload payload = {
+		.success = success,
+		.status = status,
+		.duration_ns = duration_ns > 0 ? duration_ns : 0,
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &header, .iov_len = sizeof(header) },
+		{ .iov_base = &payload, .iov_len = sizeof(payload) },
+	};
+	ssize_t amt;
+	do {
+		amt = writev(COMM_REPLY_FD, iov, 2);
+	} while (amt < 0 && errno == EINTR);
+	if (amt != COMM_REPLY_SIZE) {
+		swaylock_log_errno(LOG_ERROR, "failed to write pw check result");
+		return false;
+	}
+	return true;
+}
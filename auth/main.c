@@ -0,0 +1,62 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#elif defined(__FreeBSD__)
+#include <sys/procctl.h>
+#endif
+#include "auth.h"
+#include "log.h"
+
+// The helper isn't setuid, so other processes of the user could otherwise
+// attach to it and read the password hash or passwords out of its memory
+static bool disable_tracing(void) {
+#if defined(__linux__)
+	return prctl(PR_SET_DUMPABLE, 0) == 0;
+#elif defined(__FreeBSD__)
+	int ctl = PROC_TRACE_CTL_DISABLE;
+	return procctl(P_PID, 0, PROC_TRACE_CTL, &ctl) == 0;
+#else
+	return true;
+#endif
+}
+
+/*
+ * Checks passwords on behalf of swaylock, which starts it with the pipes and
+ * shared memory set up on fixed fds (see comm.h). It is not meant to be run
+ * by hand.
+ */
+int main(int argc, char **argv) {
+	// Before anything sensitive is read
+	if (!disable_tracing()) {
+		perror("swaylock-auth: failed to disable tracing");
+		return EXIT_FAILURE;
+	}
+
+	bool shared = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "sv:")) != -1) {
+		switch (c) {
+		case 's':
+			shared = true;
+			break;
+		case 'v':
+			swaylock_log_init(atoi(optarg));
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!comm_child_init(shared)) {
+		fprintf(stderr, "swaylock-auth is started by swaylock and can't be "
+			"used on its own\n");
+		return EXIT_FAILURE;
+	}
+	run_pw_backend_child();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // for getgrouplist
+#include <grp.h>
+#include <pwd.h>
+#include <security/pam_appl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "auth.h"
+#include "config.h"
+#include "log.h"
+
+static char *pw_buf = NULL;
+static char *username = NULL;
+
+static int handle_conversation(int num_msg, const struct pam_message **msg,
+		struct pam_response **resp, void *data) {
+	/* PAM expects an array of responses, one for each message */
+	struct pam_response *pam_reply =
+		calloc(num_msg, sizeof(struct pam_response));
+	if (pam_reply == NULL) {
+		swaylock_log(LOG_ERROR, "Allocation failed");
+		return PAM_ABORT;
+	}
+	*resp = pam_reply;
+	for (int i = 0; i < num_msg; ++i) {
+		switch (msg[i]->msg_style) {
+		case PAM_PROMPT_ECHO_OFF:
+		case PAM_PROMPT_ECHO_ON:
+			pam_reply[i].resp = strdup(pw_buf); // PAM clears and frees this
+			if (pam_reply[i].resp == NULL) {
+				swaylock_log(LOG_ERROR, "Allocation failed");
+				return PAM_ABORT;
+			}
+			break;
+		case PAM_ERROR_MSG:
+		case PAM_TEXT_INFO:
+			break;
+		}
+	}
+	return PAM_SUCCESS;
+}
+
+static const char *get_pam_auth_error(int pam_status) {
+	switch (pam_status) {
+	case PAM_AUTH_ERR:
+		return "invalid credentials";
+	case PAM_CRED_INSUFFICIENT:
+		return "swaylock cannot authenticate users; check /etc/pam.d/swaylock "
+			"has been installed properly";
+	case PAM_AUTHINFO_UNAVAIL:
+		return "authentication information unavailable";
+	case PAM_MAXTRIES:
+		return "maximum number of authentication tries exceeded";
+	default:;
+		static char msg[64];
+		snprintf(msg, sizeof(msg), "unknown error (%d)", pam_status);
+		return msg;
+	}
+}
+
+static double elapsed_ms(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double ms = (now.tv_sec - since->tv_sec) * 1e3 +
+		(now.tv_nsec - since->tv_nsec) / 1e6;
+	*since = now;
+	return ms;
+}
+
+void warm_up_pw_backend(void) {
+	// pam_authenticate() itself can't be used: a failed attempt would count
+	// towards pam_faillock and the like. Most of the cost of the first call
+	// on directory-backed systems (sssd, LDAP) comes from resolving the
+	// user and their groups, so do that instead to fill the caches.
+	struct timespec start, phase;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	phase = start;
+
+	struct passwd *passwd = getpwnam(username);
+	swaylock_log(LOG_DEBUG, "Warm-up: user lookup took %.1f ms",
+		elapsed_ms(&phase));
+
+#if HAVE_GETGROUPLIST
+	if (passwd) {
+		gid_t groups[64];
+		int ngroups = sizeof(groups) / sizeof(groups[0]);
+		getgrouplist(username, passwd->pw_gid, groups, &ngroups);
+		swaylock_log(LOG_DEBUG, "Warm-up: group lookup took %.1f ms",
+			elapsed_ms(&phase));
+	}
+#else
+	(void)passwd;
+#endif
+
+	swaylock_log(LOG_DEBUG, "Warm-up done in %.1f ms", elapsed_ms(&start));
+}
+
+void run_pw_backend_child(void) {
+	struct passwd *passwd = getpwuid(getuid());
+	username = strdup(passwd->pw_name);
+	if (!username) {
+		swaylock_log(LOG_ERROR, "Allocation failed");
+		exit(EXIT_FAILURE);
+	}
+
+	const struct pam_conv conv = {
+		.conv = handle_conversation,
+		.appdata_ptr = NULL,
+	};
+	pam_handle_t *auth_handle = NULL;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef SWAYLOCK_PAM_CONFDIR
+	// Only set when building swaylock-auth-bench, which bundles its own
+	// service so that it runs without installing anything
+	int ret = pam_start_confdir("swaylock", username, &conv,
+		SWAYLOCK_PAM_CONFDIR, &auth_handle);
+#else
+	int ret = pam_start("swaylock", username, &conv, &auth_handle);
+#endif
+	if (ret != PAM_SUCCESS) {
+		swaylock_log(LOG_ERROR, "pam_start failed");
+		exit(EXIT_FAILURE);
+	}
+	swaylock_log(LOG_DEBUG, "pam_start took %.1f ms", elapsed_ms(&start));
+
+	/* This code does not run as root */
+	swaylock_log(LOG_DEBUG, "Prepared to authorize user %s", username);
+
+	int pam_status = PAM_SUCCESS;
+	while (1) {
+		struct comm_request req;
+		ssize_t size = read_comm_request(&req, &pw_buf);
+		if (size < 0) {
+			exit(EXIT_FAILURE);
+		} else if (size == 0) {
+			break;
+		}
+
+		int pam_status = pam_authenticate(auth_handle, 0);
+		release_comm_request(&req, pw_buf, size);
+		pw_buf = NULL;
+
+		bool success = pam_status == PAM_SUCCESS;
+		if (!success) {
+			swaylock_log(LOG_ERROR, "pam_authenticate failed: %s",
+				get_pam_auth_error(pam_status));
+		}
+
+		if (!write_comm_reply(&req, success, pam_status)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pam_setcred(auth_handle, PAM_REFRESH_CRED);
+
+	if (pam_end(auth_handle, pam_status) != PAM_SUCCESS) {
+		swaylock_log(LOG_ERROR, "pam_end failed");
+		exit(EXIT_FAILURE);
+	}
+
+	exit((pam_status == PAM_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,63 @@
+#define _XOPEN_SOURCE 700 // for crypt
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+// GNU, you damn slimy bastard
+#include <crypt.h>
+#endif
+#include "auth.h"
+#include "log.h"
+#include "password-buffer.h"
+
+static char *encpw = NULL;
+static size_t encpw_size = 0;
+
+void warm_up_pw_backend(void) {
+	// Loads the hashing code and sets up its tables, which makes up a fair
+	// share of the first check with the slower algorithms
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	crypt("", encpw);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	swaylock_log(LOG_DEBUG, "Warm-up: crypt took %.1f ms",
+		(end.tv_sec - start.tv_sec) * 1e3 +
+		(end.tv_nsec - start.tv_nsec) / 1e6);
+}
+
+void run_pw_backend_child(void) {
+	encpw = read_comm_password_hash(&encpw_size);
+	if (!encpw) {
+		exit(EXIT_FAILURE);
+	}
+	while (1) {
+		struct comm_request req;
+		char *buf;
+		ssize_t size = read_comm_request(&req, &buf);
+		if (size < 0) {
+			exit(EXIT_FAILURE);
+		} else if (size == 0) {
+			break;
+		}
+
+		const char *c = crypt(buf, encpw);
+		release_comm_request(&req, buf, size);
+		buf = NULL;
+
+		if (c == NULL) {
+			swaylock_log_errno(LOG_ERROR, "crypt failed");
+			exit(EXIT_FAILURE);
+		}
+		bool success = strcmp(c, encpw) == 0;
+
+		if (!write_comm_reply(&req, success, 0)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	password_buffer_destroy(encpw, encpw_size);
+	exit(EXIT_SUCCESS);
+}
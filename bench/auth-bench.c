@@ -0,0 +1,377 @@
+#define _XOPEN_SOURCE 700 // for crypt
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <crypt.h>
+#endif
+#include "comm.h"
+#include "log.h"
+#include "password-buffer.h"
+#include "swaylock.h"
+
+/*
+ * Benchmark of the authentication path: starting swaylock-auth, the request
+ * round trip through comm.c, password buffer setup and the backend itself.
+ * swaylock-auth is built for both backends and run against a generated hash:
+ * the shadow backend gets it like from a setuid swaylock, the PAM backend
+ * through a bundled service and stand-in module. Nothing needs root or
+ * network access.
+ *
+ * Every backend and algorithm is run in a fresh process, as comm.c only
+ * supports a single auth child. Results are printed to stdout as one JSON
+ * object per line.
+ */
+
+#define BENCH_PASSWORD "correct horse battery staple"
+
+static const struct {
+	const char *name;
+	const char *prefix;
+} bench_algorithms[] = {
+	{"yescrypt", "$y$"},
+	{"sha512crypt", "$6$"},
+	{"bcrypt", "$2b$"},
+};
+
+static const struct {
+	const char *name;
+	const char *helper;
+} bench_backends[] = {
+	{"shadow", AUTH_BENCH_SHADOW_HELPER},
+#if AUTH_BENCH_PAM
+	{"pam", AUTH_BENCH_PAM_HELPER},
+#endif
+};
+
+struct bench_options {
+	const char *backend; // NULL for all
+	const char *algorithm; // NULL for all
+	const char *hash; // instead of generating one
+	int attempts;
+	bool wrong;
+	bool warm_up;
+};
+
+struct stage_stats {
+	double mean, p50, p90, p99, max;
+};
+
+// Normally in password.c, which needs the whole UI
+void clear_password_buffer(struct swaylock_password *pw) {
+	clear_buffer(pw->buffer, pw->buffer_len);
+	pw->len = 0;
+}
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double da = *(const double *)a, db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+static void get_stage_stats(double *values, int n, struct stage_stats *stats) {
+	*stats = (struct stage_stats){0};
+	if (n == 0) {
+		return;
+	}
+	double sum = 0;
+	for (int i = 0; i < n; ++i) {
+		sum += values[i];
+	}
+	qsort(values, n, sizeof(double), compare_double);
+	stats->mean = sum / n;
+	stats->p50 = values[n / 2];
+	stats->p90 = values[n * 9 / 10];
+	stats->p99 = values[n * 99 / 100];
+	stats->max = values[n - 1];
+}
+
+static void print_stage_stats(const char *name, double *values, int n) {
+	struct stage_stats stats;
+	get_stage_stats(values, n, &stats);
+	printf(",\"%s\":{\"mean\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"p99\":%.4f,"
+		"\"max\":%.4f}", name, stats.mean, stats.p50, stats.p90, stats.p99,
+		stats.max);
+}
+
+static char *generate_hash(const char *prefix) {
+	const char *salt = NULL;
+#if HAVE_CRYPT_GENSALT
+	salt = crypt_gensalt(prefix, 0, NULL, 0);
+#else
+	// Without libxcrypt, only the widely supported sha512crypt is available
+	if (strcmp(prefix, "$6$") == 0) {
+		salt = "$6$swaylockbench$";
+	}
+#endif
+	if (!salt) {
+		return NULL;
+	}
+	const char *hash = crypt(BENCH_PASSWORD, salt);
+	// Some implementations return a string starting with '*' on failure
+	if (!hash || hash[0] == '*') {
+		return NULL;
+	}
+	return strdup(hash);
+}
+
+static bool wait_for_reply(struct comm_reply *reply) {
+	while (true) {
+		int ret = read_comm_reply(reply);
+		if (ret != 0) {
+			return ret > 0;
+		}
+		struct pollfd pfd = { .fd = get_comm_reply_fd(), .events = POLLIN };
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			return false;
+		}
+	}
+}
+
+// Runs in its own process, see the comment at the top
+static bool run_case(struct bench_options *opts, const char *backend,
+		const char *helper, const char *algorithm, const char *hash) {
+	setenv("SWAYLOCK_AUTH_HELPER", helper, 1);
+	setenv("SWAYLOCK_BENCH_HASH", hash, 1); // for the PAM module
+
+	int n = opts->attempts;
+	double *buffer_us = calloc(n, sizeof(double));
+	double *round_trip_ms = calloc(n, sizeof(double));
+	double *backend_ms = calloc(n, sizeof(double));
+	double *transport_ms = calloc(n, sizeof(double));
+	if (!buffer_us || !round_trip_ms || !backend_ms || !transport_ms) {
+		swaylock_log(LOG_ERROR, "Allocation failed");
+		return false;
+	}
+
+	// The child does this for every request, time it on its own as well
+	for (int i = 0; i < n; ++i) {
+		uint64_t start = get_time_ns();
+		char *buf = password_buffer_create(sizeof(BENCH_PASSWORD));
+		if (!buf) {
+			return false;
+		}
+		password_buffer_destroy(buf, sizeof(BENCH_PASSWORD));
+		buffer_us[i] = (get_time_ns() - start) / 1e3;
+	}
+
+	struct swaylock_password pw = { .buffer_len = 1024 };
+	pw.buffer = password_buffer_create(pw.buffer_len);
+	if (!pw.buffer) {
+		return false;
+	}
+
+	uint64_t spawn_start = get_time_ns();
+	if (!spawn_comm_child()) {
+		return false;
+	}
+	double spawn_ms = (get_time_ns() - spawn_start) / 1e6;
+	if (strcmp(backend, "shadow") == 0 && !write_comm_password_hash(hash)) {
+		return false;
+	}
+	if (opts->warm_up) {
+		write_comm_warm_up();
+	}
+
+	const char *password = opts->wrong ? "wrong" : BENCH_PASSWORD;
+	int done = 0;
+	bool ok = true;
+	uint64_t bench_start = get_time_ns();
+	for (; done < n; ++done) {
+		pw.len = strlen(password);
+		memcpy(pw.buffer, password, pw.len + 1);
+
+		uint64_t start = get_time_ns();
+		uint32_t id = write_comm_request(&pw);
+		struct comm_reply reply;
+		if (!id || !wait_for_reply(&reply) || reply.id != id) {
+			swaylock_log(LOG_ERROR, "Password check %d failed", done);
+			ok = false;
+			break;
+		}
+		round_trip_ms[done] = (get_time_ns() - start) / 1e6;
+		backend_ms[done] = reply.duration_ns / 1e6;
+		transport_ms[done] = round_trip_ms[done] - backend_ms[done];
+		if (reply.success == opts->wrong) {
+			swaylock_log(LOG_ERROR, "Unexpected result (status %d)",
+				reply.status);
+			ok = false;
+			break;
+		}
+	}
+	double total_s = (get_time_ns() - bench_start) / 1e9;
+
+	printf("{\"backend\":\"%s\",\"algorithm\":\"%s\",\"attempts\":%d,"
+		"\"wrong_password\":%s,\"warm_up\":%s,\"spawn_ms\":%.4f,"
+		"\"first_round_trip_ms\":%.4f,\"attempts_per_s\":%.2f",
+		backend, algorithm, done, opts->wrong ? "true" : "false",
+		opts->warm_up ? "true" : "false", spawn_ms,
+		done > 0 ? round_trip_ms[0] : 0.0,
+		total_s > 0 ? done / total_s : 0.0);
+	print_stage_stats("buffer_create_us", buffer_us, n);
+	print_stage_stats("round_trip_ms", round_trip_ms, done);
+	print_stage_stats("backend_ms", backend_ms, done);
+	print_stage_stats("transport_ms", transport_ms, done);
+	printf(",\"ok\":%s}\n", ok ? "true" : "false");
+	fflush(stdout);
+
+	password_buffer_destroy(pw.buffer, pw.buffer_len);
+	free(buffer_us);
+	free(round_trip_ms);
+	free(backend_ms);
+	free(transport_ms);
+	return ok;
+}
+
+static bool fork_case(struct bench_options *opts, const char *backend,
+		const char *helper, const char *algorithm, const char *hash) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		swaylock_log_errno(LOG_ERROR, "fork failed");
+		return false;
+	} else if (pid == 0) {
+		// Closing the pipes on exit makes the auth child exit as well
+		exit(run_case(opts, backend, helper, algorithm, hash) ?
+			EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	int status;
+	if (waitpid(pid, &status, 0) != pid) {
+		return false;
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+static int parse_options(int argc, char **argv, struct bench_options *opts) {
+	static struct option long_options[] = {
+		{"algorithm", required_argument, NULL, 'a'},
+		{"attempts", required_argument, NULL, 'n'},
+		{"backend", required_argument, NULL, 'b'},
+		{"debug", no_argument, NULL, 'd'},
+		{"hash", required_argument, NULL, 'H'},
+		{"help", no_argument, NULL, 'h'},
+		{"warm-up", no_argument, NULL, 'W'},
+		{"wrong", no_argument, NULL, 'w'},
+		{0, 0, 0, 0}
+	};
+
+	const char usage[] =
+		"Usage: swaylock-auth-bench [options...]\n"
+		"\n"
+		"  -a, --algorithm <name>     Only use yescrypt, sha512crypt or "
+			"bcrypt.\n"
+		"  -b, --backend <name>       Only run shadow or pam.\n"
+		"  -d, --debug                Enable debugging output.\n"
+		"  -H, --hash <hash>          Use this crypt hash of \""
+			BENCH_PASSWORD "\".\n"
+		"  -h, --help                 Show help message and quit.\n"
+		"  -n, --attempts <n>         Password checks per run (default 50).\n"
+		"  -W, --warm-up              Warm up the backend before the first "
+			"check.\n"
+		"  -w, --wrong                Send a wrong password.\n"
+		"\n"
+		"Results are written to stdout as one JSON object per line. The exit\n"
+		"status is non-zero if any run failed.\n";
+
+	int c;
+	while ((c = getopt_long(argc, argv, "a:b:dH:hn:Ww",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			opts->algorithm = optarg;
+			break;
+		case 'b':
+			opts->backend = optarg;
+			break;
+		case 'd':
+			swaylock_log_init(LOG_DEBUG);
+			break;
+		case 'H':
+			opts->hash = optarg;
+			break;
+		case 'n':
+			opts->attempts = atoi(optarg);
+			break;
+		case 'W':
+			opts->warm_up = true;
+			break;
+		case 'w':
+			opts->wrong = true;
+			break;
+		case 'h':
+			fprintf(stdout, "%s", usage);
+			exit(EXIT_SUCCESS);
+		default:
+			fprintf(stderr, "%s", usage);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	swaylock_log_init(LOG_ERROR);
+	signal(SIGPIPE, SIG_IGN);
+
+	struct bench_options opts = {
+		.attempts = 50,
+	};
+	if (parse_options(argc, argv, &opts) != 0) {
+		return EXIT_FAILURE;
+	}
+	if (opts.attempts < 1) {
+		fprintf(stderr, "Attempt count must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	bool ok = true;
+	bool ran = false;
+	for (size_t i = 0; i < sizeof(bench_backends) / sizeof(bench_backends[0]);
+			++i) {
+		const char *backend = bench_backends[i].name;
+		const char *helper = bench_backends[i].helper;
+		if (opts.backend && strcmp(opts.backend, backend) != 0) {
+			continue;
+		}
+		if (opts.hash) {
+			ran = true;
+			ok = fork_case(&opts, backend, helper, "custom", opts.hash) && ok;
+			continue;
+		}
+		for (size_t j = 0; j < sizeof(bench_algorithms) /
+				sizeof(bench_algorithms[0]); ++j) {
+			const char *algorithm = bench_algorithms[j].name;
+			if (opts.algorithm && strcmp(opts.algorithm, algorithm) != 0) {
+				continue;
+			}
+			char *hash = generate_hash(bench_algorithms[j].prefix);
+			if (!hash) {
+				swaylock_log(LOG_ERROR, "%s is not supported by crypt()",
+					algorithm);
+				ok = false;
+				continue;
+			}
+			ran = true;
+			ok = fork_case(&opts, backend, helper, algorithm, hash) && ok;
+			free(hash);
+		}
+	}
+	if (!ran) {
+		fprintf(stderr, "Nothing to run\n");
+		return EXIT_FAILURE;
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
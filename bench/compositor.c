@@ -0,0 +1,710 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server.h>
+#include "compositor.h"
+#include "ext-session-lock-v1-server-protocol.h"
+
+struct bench_compositor {
+	struct wl_display *display;
+	pthread_t thread;
+	bool thread_running;
+	atomic_uint_fast64_t commits;
+
+	struct wl_list outputs; // bench_output::link
+	struct wl_list keyboards; // bench_keyboard::link
+	struct wl_list lock_surfaces; // bench_lock_surface::link
+	struct wl_resource *lock;
+	char *keymap;
+	struct bench_compositor_stats stats;
+};
+
+struct bench_output {
+	struct bench_compositor *comp;
+	struct wl_global *global;
+	int32_t width, height, scale;
+	char name[16];
+	struct wl_list link;
+};
+
+struct bench_keyboard {
+	struct wl_resource *resource;
+	struct wl_list link;
+};
+
+struct bench_surface {
+	struct bench_compositor *comp;
+	struct wl_resource *resource;
+	struct wl_resource *pending_buffer;
+	struct wl_listener pending_buffer_destroy;
+	struct wl_list frame_callbacks; // bench_frame_callback::link
+	bool subsurface;
+	bool lock_surface;
+	bool mapped; // a buffer was committed
+};
+
+struct bench_lock_surface {
+	struct wl_resource *resource;
+	struct bench_surface *surface;
+	struct wl_list link;
+};
+
+struct bench_frame_callback {
+	struct wl_resource *resource;
+	struct wl_list link;
+};
+
+static uint64_t get_time_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void resource_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void frame_callback_handle_resource_destroy(
+		struct wl_resource *resource) {
+	struct bench_frame_callback *callback =
+		wl_resource_get_user_data(resource);
+	wl_list_remove(&callback->link);
+	free(callback);
+}
+
+static void surface_set_pending_buffer(struct bench_surface *surface,
+		struct wl_resource *buffer) {
+	if (surface->pending_buffer) {
+		wl_list_remove(&surface->pending_buffer_destroy.link);
+	}
+	surface->pending_buffer = buffer;
+	if (buffer) {
+		wl_resource_add_destroy_listener(buffer,
+			&surface->pending_buffer_destroy);
+	}
+}
+
+static void surface_handle_pending_buffer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct bench_surface *surface =
+		wl_container_of(listener, surface, pending_buffer_destroy);
+	wl_list_remove(&surface->pending_buffer_destroy.link);
+	surface->pending_buffer = NULL;
+}
+
+static void surface_handle_attach(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *buffer,
+		int32_t x, int32_t y) {
+	struct bench_surface *surface = wl_resource_get_user_data(resource);
+	surface_set_pending_buffer(surface, buffer);
+}
+
+static void surface_handle_damage(struct wl_client *client,
+		struct wl_resource *resource,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+	// No-op
+}
+
+static void surface_handle_frame(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct bench_surface *surface = wl_resource_get_user_data(resource);
+	struct bench_frame_callback *callback =
+		calloc(1, sizeof(struct bench_frame_callback));
+	if (!callback) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	callback->resource = wl_resource_create(client, &wl_callback_interface,
+		1, id);
+	if (!callback->resource) {
+		free(callback);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(callback->resource, NULL, callback,
+		frame_callback_handle_resource_destroy);
+	wl_list_insert(surface->frame_callbacks.prev, &callback->link);
+}
+
+static void surface_handle_set_region(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *region) {
+	// No-op
+}
+
+static void check_locked(struct bench_compositor *comp) {
+	if (!comp->lock || comp->stats.locked) {
+		return;
+	}
+	// Only lock once every output is covered by a lock surface with content
+	int mapped = 0;
+	struct bench_lock_surface *lock_surface;
+	wl_list_for_each(lock_surface, &comp->lock_surfaces, link) {
+		if (lock_surface->surface && lock_surface->surface->mapped) {
+			++mapped;
+		}
+	}
+	if (mapped < wl_list_length(&comp->outputs)) {
+		return;
+	}
+	ext_session_lock_v1_send_locked(comp->lock);
+	comp->stats.locked = true;
+	comp->stats.locked_ns = get_time_ns();
+}
+
+static void surface_handle_commit(struct wl_client *client,
+		struct wl_resource *resource) {
+	struct bench_surface *surface = wl_resource_get_user_data(resource);
+	struct bench_compositor *comp = surface->comp;
+	atomic_fetch_add_explicit(&comp->commits, 1, memory_order_relaxed);
+
+	uint64_t now = get_time_ns();
+	// Behave like a compositor which copies buffers on commit
+	if (surface->pending_buffer) {
+		wl_buffer_send_release(surface->pending_buffer);
+		surface_set_pending_buffer(surface, NULL);
+		surface->mapped = true;
+		if (surface->subsurface) {
+			comp->stats.subsurface_buffer_commits++;
+			comp->stats.last_subsurface_buffer_commit_ns = now;
+		}
+		if (surface->lock_surface) {
+			check_locked(comp);
+		}
+	}
+
+	struct bench_frame_callback *callback, *tmp;
+	wl_list_for_each_safe(callback, tmp, &surface->frame_callbacks, link) {
+		wl_callback_send_done(callback->resource, now / 1000000);
+		wl_resource_destroy(callback->resource);
+	}
+}
+
+static void surface_handle_set_int(struct wl_client *client,
+		struct wl_resource *resource, int32_t value) {
+	// No-op
+}
+
+static void surface_handle_offset(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y) {
+	// No-op
+}
+
+static const struct wl_surface_interface surface_impl = {
+	.destroy = resource_handle_destroy,
+	.attach = surface_handle_attach,
+	.damage = surface_handle_damage,
+	.frame = surface_handle_frame,
+	.set_opaque_region = surface_handle_set_region,
+	.set_input_region = surface_handle_set_region,
+	.commit = surface_handle_commit,
+	.set_buffer_transform = surface_handle_set_int,
+	.set_buffer_scale = surface_handle_set_int,
+	.damage_buffer = surface_handle_damage,
+	.offset = surface_handle_offset,
+};
+
+static void surface_handle_resource_destroy(struct wl_resource *resource) {
+	struct bench_surface *surface = wl_resource_get_user_data(resource);
+	surface_set_pending_buffer(surface, NULL);
+	struct bench_frame_callback *callback, *tmp;
+	wl_list_for_each_safe(callback, tmp, &surface->frame_callbacks, link) {
+		wl_resource_destroy(callback->resource);
+	}
+	free(surface);
+}
+
+static void region_handle_add(struct wl_client *client,
+		struct wl_resource *resource,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+	// No-op
+}
+
+static const struct wl_region_interface region_impl = {
+	.destroy = resource_handle_destroy,
+	.add = region_handle_add,
+	.subtract = region_handle_add,
+};
+
+static void compositor_handle_create_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct bench_surface *surface = calloc(1, sizeof(struct bench_surface));
+	if (!surface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	surface->comp = wl_resource_get_user_data(resource);
+	surface->pending_buffer_destroy.notify =
+		surface_handle_pending_buffer_destroy;
+	wl_list_init(&surface->frame_callbacks);
+	surface->resource = wl_resource_create(client, &wl_surface_interface,
+		wl_resource_get_version(resource), id);
+	if (!surface->resource) {
+		free(surface);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(surface->resource, &surface_impl,
+		surface, surface_handle_resource_destroy);
+}
+
+static void compositor_handle_create_region(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct wl_resource *region = wl_resource_create(client,
+		&wl_region_interface, 1, id);
+	if (!region) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+	.create_surface = compositor_handle_create_surface,
+	.create_region = compositor_handle_create_region,
+};
+
+static void compositor_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&wl_compositor_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &compositor_impl, data, NULL);
+}
+
+static void subsurface_handle_set_position(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y) {
+	// No-op
+}
+
+static void subsurface_handle_place(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *sibling) {
+	// No-op
+}
+
+static void subsurface_handle_set_mode(struct wl_client *client,
+		struct wl_resource *resource) {
+	// No-op
+}
+
+static const struct wl_subsurface_interface subsurface_impl = {
+	.destroy = resource_handle_destroy,
+	.set_position = subsurface_handle_set_position,
+	.place_above = subsurface_handle_place,
+	.place_below = subsurface_handle_place,
+	.set_sync = subsurface_handle_set_mode,
+	.set_desync = subsurface_handle_set_mode,
+};
+
+static void subcompositor_handle_get_subsurface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface, struct wl_resource *parent) {
+	struct wl_resource *subsurface = wl_resource_create(client,
+		&wl_subsurface_interface, 1, id);
+	if (!subsurface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(subsurface, &subsurface_impl, NULL, NULL);
+	struct bench_surface *bench_surface = wl_resource_get_user_data(surface);
+	bench_surface->subsurface = true;
+}
+
+static const struct wl_subcompositor_interface subcompositor_impl = {
+	.destroy = resource_handle_destroy,
+	.get_subsurface = subcompositor_handle_get_subsurface,
+};
+
+static void subcompositor_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&wl_subcompositor_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &subcompositor_impl, data, NULL);
+}
+
+static void output_handle_release(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_output_interface output_impl = {
+	.release = output_handle_release,
+};
+
+static void output_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct bench_output *output = data;
+	struct wl_resource *resource = wl_resource_create(client,
+		&wl_output_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl, output, NULL);
+
+	wl_output_send_geometry(resource, 0, 0, 0, 0,
+		WL_OUTPUT_SUBPIXEL_UNKNOWN, "swaylock", "bench",
+		WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT,
+		output->width, output->height, 60000);
+	if (version >= 2) {
+		wl_output_send_scale(resource, output->scale);
+	}
+	if (version >= 4) {
+		wl_output_send_name(resource, output->name);
+	}
+	if (version >= 2) {
+		wl_output_send_done(resource);
+	}
+}
+
+static void keyboard_handle_resource_destroy(struct wl_resource *resource) {
+	struct bench_keyboard *keyboard = wl_resource_get_user_data(resource);
+	wl_list_remove(&keyboard->link);
+	free(keyboard);
+}
+
+static const struct wl_keyboard_interface keyboard_impl = {
+	.release = resource_handle_destroy,
+};
+
+static int create_keymap_fd(const char *keymap, size_t size) {
+	char name[64];
+	snprintf(name, sizeof(name), "/swaylock-bench-keymap-%d", getpid());
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return -1;
+	}
+	shm_unlink(name);
+	if (ftruncate(fd, size) < 0 ||
+			write(fd, keymap, size) != (ssize_t)size) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void seat_handle_get_keyboard(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct bench_compositor *comp = wl_resource_get_user_data(resource);
+	struct bench_keyboard *keyboard = calloc(1, sizeof(struct bench_keyboard));
+	if (!keyboard) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	keyboard->resource = wl_resource_create(client, &wl_keyboard_interface,
+		wl_resource_get_version(resource), id);
+	if (!keyboard->resource) {
+		free(keyboard);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(keyboard->resource, &keyboard_impl,
+		keyboard, keyboard_handle_resource_destroy);
+	wl_list_insert(&comp->keyboards, &keyboard->link);
+
+	if (comp->keymap) {
+		size_t size = strlen(comp->keymap) + 1;
+		int fd = create_keymap_fd(comp->keymap, size);
+		if (fd >= 0) {
+			wl_keyboard_send_keymap(keyboard->resource,
+				WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, size);
+			close(fd);
+		}
+	}
+	if (wl_resource_get_version(keyboard->resource) >= 4) {
+		// Key repeat would make latencies depend on the release timing
+		wl_keyboard_send_repeat_info(keyboard->resource, 0, 0);
+	}
+}
+
+static void seat_handle_get_unsupported(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	// Never advertised, clients must not ask for it
+}
+
+static const struct wl_seat_interface seat_impl = {
+	.get_pointer = seat_handle_get_unsupported,
+	.get_keyboard = seat_handle_get_keyboard,
+	.get_touch = seat_handle_get_unsupported,
+	.release = resource_handle_destroy,
+};
+
+static void seat_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&wl_seat_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &seat_impl, data, NULL);
+	wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_KEYBOARD);
+}
+
+static void lock_surface_handle_ack_configure(struct wl_client *client,
+		struct wl_resource *resource, uint32_t serial) {
+	// No-op
+}
+
+static const struct ext_session_lock_surface_v1_interface lock_surface_impl = {
+	.destroy = resource_handle_destroy,
+	.ack_configure = lock_surface_handle_ack_configure,
+};
+
+static void lock_surface_handle_resource_destroy(
+		struct wl_resource *resource) {
+	struct bench_lock_surface *lock_surface =
+		wl_resource_get_user_data(resource);
+	wl_list_remove(&lock_surface->link);
+	free(lock_surface);
+}
+
+static void lock_handle_get_lock_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface, struct wl_resource *output) {
+	struct bench_compositor *comp = wl_resource_get_user_data(resource);
+	struct bench_output *bench_output = wl_resource_get_user_data(output);
+	struct bench_lock_surface *lock_surface =
+		calloc(1, sizeof(struct bench_lock_surface));
+	if (!lock_surface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	lock_surface->resource = wl_resource_create(client,
+		&ext_session_lock_surface_v1_interface, 1, id);
+	if (!lock_surface->resource) {
+		free(lock_surface);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(lock_surface->resource, &lock_surface_impl,
+		lock_surface, lock_surface_handle_resource_destroy);
+	lock_surface->surface = wl_resource_get_user_data(surface);
+	lock_surface->surface->lock_surface = true;
+	wl_list_insert(&comp->lock_surfaces, &lock_surface->link);
+
+	ext_session_lock_surface_v1_send_configure(lock_surface->resource,
+		wl_display_next_serial(comp->display),
+		bench_output->width / bench_output->scale,
+		bench_output->height / bench_output->scale);
+
+	struct bench_keyboard *keyboard;
+	wl_list_for_each(keyboard, &comp->keyboards, link) {
+		struct wl_array keys;
+		wl_array_init(&keys);
+		wl_keyboard_send_enter(keyboard->resource,
+			wl_display_next_serial(comp->display), surface, &keys);
+		wl_array_release(&keys);
+	}
+}
+
+static void lock_handle_unlock_and_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	struct bench_compositor *comp = wl_resource_get_user_data(resource);
+	comp->stats.unlocked = true;
+	wl_resource_destroy(resource);
+}
+
+static const struct ext_session_lock_v1_interface lock_impl = {
+	.destroy = resource_handle_destroy,
+	.get_lock_surface = lock_handle_get_lock_surface,
+	.unlock_and_destroy = lock_handle_unlock_and_destroy,
+};
+
+static void lock_handle_resource_destroy(struct wl_resource *resource) {
+	struct bench_compositor *comp = wl_resource_get_user_data(resource);
+	comp->lock = NULL;
+}
+
+static void lock_manager_handle_lock(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct bench_compositor *comp = wl_resource_get_user_data(resource);
+	struct wl_resource *lock = wl_resource_create(client,
+		&ext_session_lock_v1_interface, 1, id);
+	if (!lock) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	if (comp->lock) {
+		// Only one client may lock the session at a time
+		wl_resource_set_implementation(lock, &lock_impl, comp, NULL);
+		ext_session_lock_v1_send_finished(lock);
+		return;
+	}
+	wl_resource_set_implementation(lock, &lock_impl, comp,
+		lock_handle_resource_destroy);
+	comp->lock = lock;
+}
+
+static const struct ext_session_lock_manager_v1_interface lock_manager_impl = {
+	.destroy = resource_handle_destroy,
+	.lock = lock_manager_handle_lock,
+};
+
+static void lock_manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&ext_session_lock_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &lock_manager_impl, data, NULL);
+}
+
+struct bench_compositor *bench_compositor_create(void) {
+	struct bench_compositor *comp = calloc(1, sizeof(struct bench_compositor));
+	if (!comp) {
+		return NULL;
+	}
+	wl_list_init(&comp->outputs);
+	wl_list_init(&comp->keyboards);
+	wl_list_init(&comp->lock_surfaces);
+	comp->display = wl_display_create();
+	if (!comp->display) {
+		free(comp);
+		return NULL;
+	}
+	if (wl_display_init_shm(comp->display) != 0 ||
+			!wl_display_add_shm_format(comp->display, WL_SHM_FORMAT_RGB565) ||
+			!wl_global_create(comp->display, &wl_compositor_interface, 4,
+				comp, compositor_bind) ||
+			!wl_global_create(comp->display, &wl_subcompositor_interface, 1,
+				comp, subcompositor_bind)) {
+		wl_display_destroy(comp->display);
+		free(comp);
+		return NULL;
+	}
+	return comp;
+}
+
+void bench_compositor_destroy(struct bench_compositor *comp) {
+	if (comp->thread_running) {
+		bench_compositor_stop_thread(comp);
+	}
+	wl_display_destroy_clients(comp->display);
+	struct bench_output *output, *tmp;
+	wl_list_for_each_safe(output, tmp, &comp->outputs, link) {
+		wl_list_remove(&output->link);
+		free(output);
+	}
+	wl_display_destroy(comp->display);
+	free(comp->keymap);
+	free(comp);
+}
+
+bool bench_compositor_add_output(struct bench_compositor *comp,
+		int32_t width, int32_t height, int32_t scale) {
+	struct bench_output *output = calloc(1, sizeof(struct bench_output));
+	if (!output) {
+		return false;
+	}
+	output->comp = comp;
+	output->width = width;
+	output->height = height;
+	output->scale = scale;
+	snprintf(output->name, sizeof(output->name), "BENCH-%d",
+		wl_list_length(&comp->outputs) + 1);
+	output->global = wl_global_create(comp->display, &wl_output_interface, 4,
+		output, output_bind);
+	if (!output->global) {
+		free(output);
+		return false;
+	}
+	wl_list_insert(comp->outputs.prev, &output->link);
+	return true;
+}
+
+bool bench_compositor_add_seat(struct bench_compositor *comp,
+		const char *keymap) {
+	comp->keymap = strdup(keymap);
+	if (!comp->keymap) {
+		return false;
+	}
+	return wl_global_create(comp->display, &wl_seat_interface, 4,
+			comp, seat_bind) &&
+		wl_global_create(comp->display,
+			&ext_session_lock_manager_v1_interface, 1,
+			comp, lock_manager_bind);
+}
+
+void bench_compositor_send_key(struct bench_compositor *comp, uint32_t key,
+		bool pressed) {
+	uint32_t time = get_time_ns() / 1000000;
+	struct bench_keyboard *keyboard;
+	wl_list_for_each(keyboard, &comp->keyboards, link) {
+		wl_keyboard_send_key(keyboard->resource,
+			wl_display_next_serial(comp->display), time, key,
+			pressed ? WL_KEYBOARD_KEY_STATE_PRESSED :
+				WL_KEYBOARD_KEY_STATE_RELEASED);
+	}
+	wl_display_flush_clients(comp->display);
+}
+
+bool bench_compositor_dispatch(struct bench_compositor *comp, int timeout) {
+	wl_display_flush_clients(comp->display);
+	if (wl_event_loop_dispatch(
+			wl_display_get_event_loop(comp->display), timeout) < 0) {
+		return false;
+	}
+	wl_display_flush_clients(comp->display);
+	return true;
+}
+
+void bench_compositor_get_stats(struct bench_compositor *comp,
+		struct bench_compositor_stats *stats) {
+	*stats = comp->stats;
+}
+
+int bench_compositor_connect(struct bench_compositor *comp) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		return -1;
+	}
+	if (!wl_client_create(comp->display, fds[0])) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	return fds[1];
+}
+
+static void *compositor_thread(void *data) {
+	struct bench_compositor *comp = data;
+	wl_display_run(comp->display);
+	return NULL;
+}
+
+bool bench_compositor_start_thread(struct bench_compositor *comp) {
+	if (pthread_create(&comp->thread, NULL, compositor_thread, comp) != 0) {
+		return false;
+	}
+	comp->thread_running = true;
+	return true;
+}
+
+void bench_compositor_stop_thread(struct bench_compositor *comp) {
+	wl_display_terminate(comp->display);
+	pthread_join(comp->thread, NULL);
+	comp->thread_running = false;
+}
+
+uint64_t bench_compositor_get_commits(struct bench_compositor *comp) {
+	return atomic_load_explicit(&comp->commits, memory_order_relaxed);
+}
@@ -0,0 +1,75 @@
+#ifndef _SWAYLOCK_BENCH_COMPOSITOR_H
+#define _SWAYLOCK_BENCH_COMPOSITOR_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * A minimal in-process Wayland compositor for the benchmarks. It implements
+ * just enough of the protocol for swaylock to run: wl_compositor,
+ * wl_subcompositor, wl_shm, and optionally virtual wl_outputs, a wl_seat with
+ * a keyboard and ext_session_lock_manager_v1. Buffers are released as soon as
+ * they are committed and frame callbacks complete immediately, so the client
+ * never waits on a (fake) vblank.
+ */
+
+struct bench_compositor;
+
+struct bench_compositor_stats {
+	bool locked, unlocked;
+	uint64_t locked_ns; // CLOCK_MONOTONIC time the locked event was sent
+	uint64_t subsurface_buffer_commits;
+	uint64_t last_subsurface_buffer_commit_ns;
+};
+
+struct bench_compositor *bench_compositor_create(void);
+void bench_compositor_destroy(struct bench_compositor *comp);
+
+/**
+ * Advertise a virtual output. The size is in physical pixels.
+ */
+bool bench_compositor_add_output(struct bench_compositor *comp,
+	int32_t width, int32_t height, int32_t scale);
+
+/**
+ * Advertise a seat with a keyboard using the given XKB keymap, together with
+ * ext_session_lock_manager_v1. The session is reported as locked once every
+ * output has a lock surface with a buffer.
+ */
+bool bench_compositor_add_seat(struct bench_compositor *comp,
+	const char *keymap);
+
+/**
+ * Send a key event (evdev keycode) to every bound keyboard.
+ */
+void bench_compositor_send_key(struct bench_compositor *comp, uint32_t key,
+	bool pressed);
+
+/**
+ * Dispatch compositor events on the calling thread, waiting at most timeout
+ * ms (-1 to wait forever).
+ */
+bool bench_compositor_dispatch(struct bench_compositor *comp, int timeout);
+
+void bench_compositor_get_stats(struct bench_compositor *comp,
+	struct bench_compositor_stats *stats);
+
+/**
+ * Create a client connected to the compositor over a socketpair. The returned
+ * fd is the client end, suitable for wl_display_connect_to_fd() or for
+ * passing to a child process as WAYLAND_SOCKET.
+ */
+int bench_compositor_connect(struct bench_compositor *comp);
+
+/**
+ * Run the compositor on a background thread until
+ * bench_compositor_stop_thread() is called.
+ */
+bool bench_compositor_start_thread(struct bench_compositor *comp);
+void bench_compositor_stop_thread(struct bench_compositor *comp);
+
+/**
+ * Number of wl_surface.commit requests received so far.
+ */
+uint64_t bench_compositor_get_commits(struct bench_compositor *comp);
+
+#endif
@@ -0,0 +1,437 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+#include "compositor.h"
+#include "log.h"
+
+/*
+ * End-to-end benchmark of the real swaylock binary. swaylock is spawned with
+ * WAYLAND_SOCKET pointing at an in-process compositor, which measures the
+ * time until the session is locked, the latency from a key press to the
+ * indicator being committed on every output, and the resident set size.
+ */
+
+#define KEY_ESC 1
+#define KEY_A 30
+
+static const int default_output_counts[] = {1, 4, 16, 32};
+
+struct bench_options {
+	const char *swaylock;
+	char **swaylock_args;
+	int n_swaylock_args;
+	int output_counts[16];
+	int n_output_counts;
+	int width, height, scale;
+	int keys;
+	int timeout_ms;
+	double max_lock_ms;
+	double max_key_ms;
+	long max_rss_kb;
+};
+
+struct bench_result {
+	bool ok;
+	double time_to_locked_ms;
+	double key_mean_ms, key_p50_ms, key_max_ms;
+	long rss_kb, peak_rss_kb;
+};
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static char *get_keymap_string(void) {
+	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	if (!context) {
+		return NULL;
+	}
+	struct xkb_keymap *keymap = xkb_keymap_new_from_names(context, NULL,
+		XKB_KEYMAP_COMPILE_NO_FLAGS);
+	char *str = NULL;
+	if (keymap) {
+		str = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+		xkb_keymap_unref(keymap);
+	}
+	xkb_context_unref(context);
+	return str;
+}
+
+static pid_t spawn_swaylock(struct bench_options *opts, int fd) {
+	pid_t pid = fork();
+	if (pid != 0) {
+		return pid;
+	}
+
+	// The socketpair is close-on-exec, hand a plain copy to swaylock
+	int socket_fd = dup(fd);
+	if (socket_fd < 0) {
+		_exit(127);
+	}
+	char fd_str[16];
+	snprintf(fd_str, sizeof(fd_str), "%d", socket_fd);
+	setenv("WAYLAND_SOCKET", fd_str, 1);
+	// Unless told otherwise, use the auth helper from the build directory
+	setenv("SWAYLOCK_AUTH_HELPER", SWAYLOCK_AUTH_BIN, 0);
+
+	char **argv = calloc(opts->n_swaylock_args + 4, sizeof(char *));
+	int argc = 0;
+	argv[argc++] = (char *)opts->swaylock;
+	// Don't pick up the user's configuration
+	argv[argc++] = "--config";
+	argv[argc++] = "/dev/null";
+	for (int i = 0; i < opts->n_swaylock_args; ++i) {
+		argv[argc++] = opts->swaylock_args[i];
+	}
+	execv(opts->swaylock, argv);
+	fprintf(stderr, "Failed to exec %s: %s\n", opts->swaylock, strerror(errno));
+	_exit(127);
+}
+
+struct bench_child {
+	pid_t pid;
+	bool reaped; // its pid may belong to another process by now
+};
+
+static bool child_exited(struct bench_child *child) {
+	if (!child->reaped && waitpid(child->pid, NULL, WNOHANG) == child->pid) {
+		child->reaped = true;
+	}
+	return child->reaped;
+}
+
+static void read_rss(pid_t pid, long *rss_kb, long *peak_rss_kb) {
+	*rss_kb = *peak_rss_kb = -1;
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		sscanf(line, "VmRSS: %ld kB", rss_kb);
+		sscanf(line, "VmHWM: %ld kB", peak_rss_kb);
+	}
+	fclose(f);
+}
+
+static int compare_double(const void *a, const void *b) {
+	double da = *(const double *)a, db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+// Dispatch until the predicate holds, the deadline passes or swaylock dies
+static bool dispatch_until(struct bench_compositor *comp,
+		struct bench_child *child,
+		uint64_t deadline, bool (*done)(struct bench_compositor_stats *stats,
+			uint64_t arg), uint64_t arg) {
+	struct bench_compositor_stats stats;
+	while (true) {
+		bench_compositor_get_stats(comp, &stats);
+		if (done(&stats, arg)) {
+			return true;
+		}
+		uint64_t now = get_time_ns();
+		if (now >= deadline || child_exited(child)) {
+			return false;
+		}
+		int timeout = (deadline - now) / 1000000;
+		if (!bench_compositor_dispatch(comp, timeout < 10 ? timeout : 10)) {
+			return false;
+		}
+	}
+}
+
+static bool is_locked(struct bench_compositor_stats *stats, uint64_t arg) {
+	return stats->locked;
+}
+
+static bool is_unlocked(struct bench_compositor_stats *stats, uint64_t arg) {
+	return stats->unlocked;
+}
+
+static bool has_commits(struct bench_compositor_stats *stats, uint64_t arg) {
+	return stats->subsurface_buffer_commits >= arg;
+}
+
+static bool never(struct bench_compositor_stats *stats, uint64_t arg) {
+	return false;
+}
+
+static void run_case(struct bench_options *opts, int n_outputs,
+		const char *keymap, struct bench_result *res) {
+	*res = (struct bench_result){0};
+
+	struct bench_compositor *comp = bench_compositor_create();
+	if (!comp || !bench_compositor_add_seat(comp, keymap)) {
+		swaylock_log(LOG_ERROR, "Failed to create the compositor");
+		return;
+	}
+	for (int i = 0; i < n_outputs; ++i) {
+		if (!bench_compositor_add_output(comp, opts->width, opts->height,
+				opts->scale)) {
+			swaylock_log(LOG_ERROR, "Failed to add output");
+			bench_compositor_destroy(comp);
+			return;
+		}
+	}
+	int fd = bench_compositor_connect(comp);
+	if (fd < 0) {
+		swaylock_log(LOG_ERROR, "Failed to create the client socket");
+		bench_compositor_destroy(comp);
+		return;
+	}
+
+	uint64_t start = get_time_ns();
+	struct bench_child child = { .pid = spawn_swaylock(opts, fd) };
+	close(fd);
+	if (child.pid < 0) {
+		swaylock_log_errno(LOG_ERROR, "fork failed");
+		bench_compositor_destroy(comp);
+		return;
+	}
+
+	uint64_t timeout_ns = (uint64_t)opts->timeout_ms * 1000000;
+	struct bench_compositor_stats stats;
+	if (!dispatch_until(comp, &child, start + timeout_ns, is_locked, 0)) {
+		swaylock_log(LOG_ERROR, "swaylock did not lock the session");
+		goto out;
+	}
+	bench_compositor_get_stats(comp, &stats);
+	res->time_to_locked_ms = (stats.locked_ns - start) / 1e6;
+
+	// Let the initial frames settle
+	dispatch_until(comp, &child, get_time_ns() + 100000000, never, 0);
+
+	double *latencies = calloc(opts->keys, sizeof(double));
+	int n_latencies = 0;
+	for (int i = 0; i < opts->keys; ++i) {
+		bench_compositor_get_stats(comp, &stats);
+		uint64_t target = stats.subsurface_buffer_commits + n_outputs;
+		uint64_t pressed = get_time_ns();
+		bench_compositor_send_key(comp, KEY_A + i % 4, true);
+		bool committed = dispatch_until(comp, &child, pressed + timeout_ns,
+			has_commits, target);
+		bench_compositor_send_key(comp, KEY_A + i % 4, false);
+		if (!committed) {
+			swaylock_log(LOG_ERROR, "Indicator was not redrawn after a key");
+			break;
+		}
+		bench_compositor_get_stats(comp, &stats);
+		latencies[n_latencies++] =
+			(stats.last_subsurface_buffer_commit_ns - pressed) / 1e6;
+		// Leave some room between keys, like a fast typist would
+		dispatch_until(comp, &child, get_time_ns() + 20000000, never, 0);
+	}
+	res->rss_kb = res->peak_rss_kb = -1;
+	if (!child_exited(&child)) {
+		read_rss(child.pid, &res->rss_kb, &res->peak_rss_kb);
+	}
+
+	if (n_latencies == opts->keys && n_latencies > 0) {
+		double sum = 0;
+		for (int i = 0; i < n_latencies; ++i) {
+			sum += latencies[i];
+		}
+		qsort(latencies, n_latencies, sizeof(double), compare_double);
+		res->key_mean_ms = sum / n_latencies;
+		res->key_p50_ms = latencies[n_latencies / 2];
+		res->key_max_ms = latencies[n_latencies - 1];
+		res->ok = true;
+	}
+	free(latencies);
+
+	// Clear the password, then unlock through SIGUSR1
+	bench_compositor_send_key(comp, KEY_ESC, true);
+	bench_compositor_send_key(comp, KEY_ESC, false);
+
+out:
+	if (!child_exited(&child)) {
+		kill(child.pid, SIGUSR1);
+		dispatch_until(comp, &child, get_time_ns() + timeout_ns,
+			is_unlocked, 0);
+	}
+	if (!child_exited(&child)) {
+		kill(child.pid, SIGKILL);
+		waitpid(child.pid, NULL, 0);
+	}
+	bench_compositor_destroy(comp);
+}
+
+static bool check_thresholds(struct bench_options *opts,
+		struct bench_result *res) {
+	bool ok = res->ok;
+	if (opts->max_lock_ms > 0 && res->time_to_locked_ms > opts->max_lock_ms) {
+		swaylock_log(LOG_ERROR, "time to locked %.2f ms exceeds %.2f ms",
+			res->time_to_locked_ms, opts->max_lock_ms);
+		ok = false;
+	}
+	if (opts->max_key_ms > 0 && res->key_p50_ms > opts->max_key_ms) {
+		swaylock_log(LOG_ERROR, "key to commit %.2f ms exceeds %.2f ms",
+			res->key_p50_ms, opts->max_key_ms);
+		ok = false;
+	}
+	if (opts->max_rss_kb > 0 && res->rss_kb > opts->max_rss_kb) {
+		swaylock_log(LOG_ERROR, "RSS %ld kB exceeds %ld kB",
+			res->rss_kb, opts->max_rss_kb);
+		ok = false;
+	}
+	return ok;
+}
+
+static int parse_options(int argc, char **argv, struct bench_options *opts) {
+	static struct option long_options[] = {
+		{"debug", no_argument, NULL, 'd'},
+		{"help", no_argument, NULL, 'h'},
+		{"keys", required_argument, NULL, 'k'},
+		{"max-key-ms", required_argument, NULL, 'K'},
+		{"max-lock-ms", required_argument, NULL, 'L'},
+		{"max-rss-kb", required_argument, NULL, 'R'},
+		{"outputs", required_argument, NULL, 'o'},
+		{"scale", required_argument, NULL, 's'},
+		{"size", required_argument, NULL, 'S'},
+		{"swaylock", required_argument, NULL, 'b'},
+		{"timeout", required_argument, NULL, 't'},
+		{0, 0, 0, 0}
+	};
+
+	const char usage[] =
+		"Usage: swaylock-lock-bench [options...] [-- swaylock options...]\n"
+		"\n"
+		"  -b, --swaylock <path>      swaylock binary to run.\n"
+		"  -d, --debug                Enable debugging output.\n"
+		"  -h, --help                 Show help message and quit.\n"
+		"  -k, --keys <n>             Key presses per run (default 32).\n"
+		"  -K, --max-key-ms <ms>      Fail if the median key to commit "
+			"latency is higher.\n"
+		"  -L, --max-lock-ms <ms>     Fail if the time to locked is higher.\n"
+		"  -R, --max-rss-kb <kB>      Fail if the RSS is higher.\n"
+		"  -o, --outputs <n,...>      Output counts (default 1,4,16,32).\n"
+		"  -s, --scale <scale>        Output scale (default 1).\n"
+		"  -S, --size <WxH>           Output size (default 1920x1080).\n"
+		"  -t, --timeout <ms>         Timeout for every step (default 10000).\n"
+		"\n"
+		"Results are written to stdout as one JSON object per line. The exit\n"
+		"status is non-zero if any run failed or exceeded a threshold.\n";
+
+	int c;
+	while ((c = getopt_long(argc, argv, "b:dhk:K:L:R:o:s:S:t:",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			opts->swaylock = optarg;
+			break;
+		case 'd':
+			swaylock_log_init(LOG_DEBUG);
+			break;
+		case 'k':
+			opts->keys = atoi(optarg);
+			break;
+		case 'K':
+			opts->max_key_ms = strtod(optarg, NULL);
+			break;
+		case 'L':
+			opts->max_lock_ms = strtod(optarg, NULL);
+			break;
+		case 'R':
+			opts->max_rss_kb = strtol(optarg, NULL, 10);
+			break;
+		case 'o': {
+			opts->n_output_counts = 0;
+			char *tok = strtok(optarg, ",");
+			while (tok && opts->n_output_counts <
+					(int)(sizeof(opts->output_counts) / sizeof(int))) {
+				opts->output_counts[opts->n_output_counts++] = atoi(tok);
+				tok = strtok(NULL, ",");
+			}
+			break;
+		}
+		case 's':
+			opts->scale = atoi(optarg);
+			break;
+		case 'S':
+			if (sscanf(optarg, "%dx%d", &opts->width, &opts->height) != 2) {
+				fprintf(stderr, "Invalid size %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			opts->timeout_ms = atoi(optarg);
+			break;
+		case 'h':
+			fprintf(stdout, "%s", usage);
+			exit(EXIT_SUCCESS);
+		default:
+			fprintf(stderr, "%s", usage);
+			return 1;
+		}
+	}
+	opts->swaylock_args = &argv[optind];
+	opts->n_swaylock_args = argc - optind;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	swaylock_log_init(LOG_ERROR);
+	signal(SIGPIPE, SIG_IGN);
+
+	struct bench_options opts = {
+		.swaylock = SWAYLOCK_BIN,
+		.width = 1920,
+		.height = 1080,
+		.scale = 1,
+		.keys = 32,
+		.timeout_ms = 10000,
+	};
+	opts.n_output_counts =
+		sizeof(default_output_counts) / sizeof(default_output_counts[0]);
+	memcpy(opts.output_counts, default_output_counts,
+		sizeof(default_output_counts));
+	if (parse_options(argc, argv, &opts) != 0) {
+		return EXIT_FAILURE;
+	}
+	if (opts.scale < 1 || opts.keys < 1) {
+		fprintf(stderr, "Scale and key count must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	char *keymap = get_keymap_string();
+	if (!keymap) {
+		swaylock_log(LOG_ERROR, "Failed to compile the default keymap");
+		return EXIT_FAILURE;
+	}
+
+	bool ok = true;
+	for (int i = 0; i < opts.n_output_counts; ++i) {
+		struct bench_result res;
+		run_case(&opts, opts.output_counts[i], keymap, &res);
+		printf("{\"outputs\":%d,\"width\":%d,\"height\":%d,\"scale\":%d,"
+			"\"time_to_locked_ms\":%.3f,\"key_to_commit_ms_mean\":%.3f,"
+			"\"key_to_commit_ms_p50\":%.3f,\"key_to_commit_ms_max\":%.3f,"
+			"\"rss_kb\":%ld,\"peak_rss_kb\":%ld,\"ok\":%s}\n",
+			opts.output_counts[i], opts.width, opts.height, opts.scale,
+			res.time_to_locked_ms, res.key_mean_ms, res.key_p50_ms,
+			res.key_max_ms, res.rss_kb, res.peak_rss_kb,
+			res.ok ? "true" : "false");
+		fflush(stdout);
+		if (!check_thresholds(&opts, &res)) {
+			ok = false;
+		}
+	}
+
+	free(keymap);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,57 @@
+#define _XOPEN_SOURCE 700 // for crypt
+#include <security/pam_appl.h>
+#include <security/pam_modules.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <crypt.h>
+#endif
+
+/*
+ * Stand-in PAM module for swaylock-auth-bench. The password is asked for
+ * through the conversation like pam_unix does, and checked against the crypt
+ * hash in $SWAYLOCK_BENCH_HASH, so that the PAM overhead can be compared with
+ * the shadow backend for the same algorithm.
+ */
+
+static char *ask_password(pam_handle_t *pamh) {
+	const struct pam_conv *conv = NULL;
+	if (pam_get_item(pamh, PAM_CONV, (const void **)&conv) != PAM_SUCCESS ||
+			!conv || !conv->conv) {
+		return NULL;
+	}
+	struct pam_message msg = {
+		.msg_style = PAM_PROMPT_ECHO_OFF,
+		.msg = "Password: ",
+	};
+	const struct pam_message *msgs = &msg;
+	struct pam_response *resp = NULL;
+	if (conv->conv(1, &msgs, &resp, conv->appdata_ptr) != PAM_SUCCESS ||
+			!resp) {
+		return NULL;
+	}
+	char *password = resp->resp;
+	free(resp);
+	return password;
+}
+
+PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags,
+		int argc, const char **argv) {
+	const char *hash = getenv("SWAYLOCK_BENCH_HASH");
+	if (!hash) {
+		return PAM_AUTHINFO_UNAVAIL;
+	}
+	char *password = ask_password(pamh);
+	if (!password) {
+		return PAM_CONV_ERR;
+	}
+	const char *c = crypt(password, hash);
+	free(password);
+	return c && strcmp(c, hash) == 0 ? PAM_SUCCESS : PAM_AUTH_ERR;
+}
+
+PAM_EXTERN int pam_sm_setcred(pam_handle_t *pamh, int flags,
+		int argc, const char **argv) {
+	return PAM_SUCCESS;
+}
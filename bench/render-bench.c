@@ -0,0 +1,1058 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+#include "background-image.h"
+#include "cairo.h"
+#include "compositor.h"
+#include "log.h"
+#include "pool-buffer.h"
+#include "ring-raster.h"
+#include "swaylock.h"
+
+#define M_PI 3.14159265358979323846
+
+/*
+ * Headless benchmark for render.c and background-image.c. Frames are rendered
+ * against an in-process compositor and results are printed to stdout as one
+ * JSON object per line.
+ */
+
+#ifdef __GLIBC__
+// Count allocations made by the benchmarked code by wrapping the allocator.
+// Only the thread which sets alloc_counting is accounted for, so the
+// compositor thread does not skew the numbers.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static _Thread_local bool alloc_counting = false;
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+
+static void count_alloc(size_t size) {
+	if (alloc_counting) {
+		++alloc_count;
+		alloc_bytes += size;
+	}
+}
+
+void *malloc(size_t size) {
+	count_alloc(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	count_alloc(nmemb * size);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	count_alloc(size);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+#define HAVE_ALLOC_COUNTING 1
+#else
+static bool alloc_counting = false;
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+#define HAVE_ALLOC_COUNTING 0
+#endif
+
+static const struct {
+	int width, height;
+} bench_sizes[] = {
+	{1920, 1080},
+	{2560, 1440},
+	{3840, 2160},
+	{7680, 4320},
+};
+
+static const int bench_scales[] = {1, 2, 3};
+
+static const struct {
+	const char *name;
+	enum background_mode mode;
+} bench_modes[] = {
+	{"solid_color", BACKGROUND_MODE_SOLID_COLOR},
+	{"stretch", BACKGROUND_MODE_STRETCH},
+	{"fill", BACKGROUND_MODE_FILL},
+	{"fit", BACKGROUND_MODE_FIT},
+	{"center", BACKGROUND_MODE_CENTER},
+	{"tile", BACKGROUND_MODE_TILE},
+};
+
+enum indicator_case {
+	INDICATOR_IDLE,
+	INDICATOR_TYPING,
+	INDICATOR_BACKSPACE,
+	INDICATOR_CLEARED,
+	INDICATOR_VERIFYING,
+	INDICATOR_WRONG,
+	INDICATOR_CAPS_LOCK,
+	INDICATOR_LAYOUT,
+	INDICATOR_LAST,
+};
+
+static const char *indicator_case_names[] = {
+	[INDICATOR_IDLE] = "idle",
+	[INDICATOR_TYPING] = "typing",
+	[INDICATOR_BACKSPACE] = "backspace",
+	[INDICATOR_CLEARED] = "cleared",
+	[INDICATOR_VERIFYING] = "verifying",
+	[INDICATOR_WRONG] = "wrong",
+	[INDICATOR_CAPS_LOCK] = "caps-lock",
+	[INDICATOR_LAYOUT] = "layout",
+};
+
+struct bench_options {
+	const char *size; // WxH filter, or NULL
+	int scale; // 0 for all
+	const char *mode; // background mode filter, or NULL
+	const char *indicator; // indicator state filter, or NULL
+	const char *group; // background, image, ring or indicator, or NULL for all
+	const char *image_path;
+	bool low_memory; // draw opaque backgrounds as RGB565
+	int min_time_ms;
+	int min_frames;
+};
+
+struct bench_result {
+	uint64_t frames;
+	uint64_t total_ns;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+};
+
+static struct swaylock_state state;
+static struct swaylock_xkb bench_xkb;
+static struct bench_compositor *compositor;
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long get_peak_rss_kb(void) {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return -1;
+	}
+	return usage.ru_maxrss;
+}
+
+static void shm_handle_format(void *data, struct wl_shm *shm,
+		uint32_t format) {
+	if (format == WL_SHM_FORMAT_RGB565) {
+		state.shm_rgb565 = true;
+	}
+}
+
+static const struct wl_shm_listener shm_listener = {
+	.format = shm_handle_format,
+};
+
+static void handle_global(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version) {
+	if (strcmp(interface, wl_compositor_interface.name) == 0) {
+		state.compositor = wl_registry_bind(registry, name,
+				&wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		state.subcompositor = wl_registry_bind(registry, name,
+				&wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		state.shm = wl_registry_bind(registry, name,
+				&wl_shm_interface, 1);
+		wl_shm_add_listener(state.shm, &shm_listener, NULL);
+	}
+}
+
+static void handle_global_remove(void *data, struct wl_registry *registry,
+		uint32_t name) {
+	// Who cares
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = handle_global_remove,
+};
+
+static void set_bench_colors(struct swaylock_colors *colors) {
+	// Same as the swaylock defaults, so that blending costs are realistic
+	colors->background = 0xFFFFFFFF;
+	colors->bs_highlight = 0xDB3300FF;
+	colors->key_highlight = 0x33DB00FF;
+	colors->caps_lock_bs_highlight = 0xDB3300FF;
+	colors->caps_lock_key_highlight = 0x33DB00FF;
+	colors->separator = 0x000000FF;
+	colors->layout_background = 0x000000C0;
+	colors->layout_border = 0x00000000;
+	colors->layout_text = 0xFFFFFFFF;
+	colors->inside = (struct swaylock_colorset){
+		.input = 0x000000C0,
+		.cleared = 0xE5A445C0,
+		.caps_lock = 0x000000C0,
+		.verifying = 0x0072FFC0,
+		.wrong = 0xFA0000C0,
+	};
+	colors->line = (struct swaylock_colorset){
+		.input = 0x000000FF,
+		.cleared = 0x000000FF,
+		.caps_lock = 0x000000FF,
+		.verifying = 0x000000FF,
+		.wrong = 0x000000FF,
+	};
+	colors->ring = (struct swaylock_colorset){
+		.input = 0x337D00FF,
+		.cleared = 0xE5A445FF,
+		.caps_lock = 0xE5A445FF,
+		.verifying = 0x3300FFFF,
+		.wrong = 0x7D3300FF,
+	};
+	colors->text = (struct swaylock_colorset){
+		.input = 0xE5A445FF,
+		.cleared = 0x000000FF,
+		.caps_lock = 0xE5A445FF,
+		.verifying = 0x000000FF,
+		.wrong = 0x000000FF,
+	};
+}
+
+static cairo_surface_t *create_test_image(void) {
+	// A wallpaper-sized opaque image with some structure, so that scaling
+	// is not trivially cheap
+	int width = 2560, height = 1440;
+	cairo_surface_t *image =
+		cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+	cairo_t *cairo = cairo_create(image);
+	for (int y = 0; y < height; y += 32) {
+		for (int x = 0; x < width; x += 32) {
+			cairo_set_source_rgb(cairo, (double)x / width,
+				(double)y / height, ((x ^ y) & 0xff) / 255.0);
+			cairo_rectangle(cairo, x, y, 32, 32);
+			cairo_fill(cairo);
+		}
+	}
+	cairo_destroy(cairo);
+	cairo_surface_flush(image);
+	return image;
+}
+
+static struct swaylock_surface *create_bench_surface(int width, int height,
+		int scale, cairo_surface_t *image) {
+	struct swaylock_surface *surface =
+		calloc(1, sizeof(struct swaylock_surface));
+	assert(surface);
+	surface->state = &state;
+	surface->image = image;
+	surface->width = width;
+	surface->height = height;
+	surface->scale = scale;
+	surface->subpixel = WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB;
+	surface->surface = wl_compositor_create_surface(state.compositor);
+	surface->child = wl_compositor_create_surface(state.compositor);
+	surface->subsurface = wl_subcompositor_get_subsurface(state.subcompositor,
+		surface->child, surface->surface);
+	wl_subsurface_set_sync(surface->subsurface);
+	return surface;
+}
+
+static void destroy_bench_surface(struct swaylock_surface *surface) {
+	wl_subsurface_destroy(surface->subsurface);
+	wl_surface_destroy(surface->child);
+	wl_surface_destroy(surface->surface);
+	destroy_buffer(&surface->indicator_buffers[0]);
+	destroy_buffer(&surface->indicator_buffers[1]);
+	free(surface);
+}
+
+static void sync_compositor(void) {
+	// Let the compositor release buffers and fire frame callbacks
+	if (wl_display_roundtrip(state.display) == -1) {
+		swaylock_log(LOG_ERROR, "wl_display_roundtrip() failed");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static bool bench_done(struct bench_options *opts, struct bench_result *res) {
+	return res->frames >= (uint64_t)opts->min_frames &&
+		res->total_ns >= (uint64_t)opts->min_time_ms * 1000000;
+}
+
+static void begin_frame(uint64_t *start) {
+	alloc_counting = true;
+	*start = get_time_ns();
+}
+
+static void end_frame(struct bench_result *res, uint64_t start,
+		uint64_t allocs_before, uint64_t bytes_before) {
+	res->total_ns += get_time_ns() - start;
+	alloc_counting = false;
+	res->allocs += alloc_count - allocs_before;
+	res->alloc_bytes += alloc_bytes - bytes_before;
+	res->frames++;
+}
+
+static void print_result(const char *group, const char *variant,
+		int width, int height, int scale, struct bench_result *res) {
+	double ns_per_frame = (double)res->total_ns / res->frames;
+	printf("{\"group\":\"%s\",\"variant\":\"%s\","
+		"\"width\":%d,\"height\":%d,\"scale\":%d,"
+		"\"frames\":%llu,\"fps\":%.2f,\"ns_per_frame\":%.0f,",
+		group, variant, width, height, scale,
+		(unsigned long long)res->frames, 1e9 / ns_per_frame, ns_per_frame);
+	if (HAVE_ALLOC_COUNTING) {
+		printf("\"allocs_per_frame\":%.2f,\"alloc_bytes_per_frame\":%.0f,",
+			(double)res->allocs / res->frames,
+			(double)res->alloc_bytes / res->frames);
+	} else {
+		printf("\"allocs_per_frame\":null,\"alloc_bytes_per_frame\":null,");
+	}
+	printf("\"peak_rss_kb\":%ld}\n", get_peak_rss_kb());
+	fflush(stdout);
+}
+
+static void bench_background(struct bench_options *opts, int width,
+		int height, int scale, enum background_mode mode, const char *name,
+		cairo_surface_t *image) {
+	state.args.mode = mode;
+	struct swaylock_surface *surface =
+		create_bench_surface(width / scale, height / scale, scale, image);
+
+	struct bench_result res = {0};
+	while (!bench_done(opts, &res)) {
+		// Force a full redraw, as if the output had just been configured
+		surface->last_buffer_width = 0;
+		surface->last_buffer_height = 0;
+
+		uint64_t start, allocs = alloc_count, bytes = alloc_bytes;
+		begin_frame(&start);
+		render_frame_background(surface);
+		end_frame(&res, start, allocs, bytes);
+
+		sync_compositor();
+	}
+	char variant[64];
+	snprintf(variant, sizeof(variant), "%s%s", name,
+		state.args.low_memory ? "-low-memory" : "");
+	print_result("background", variant, width, height, scale, &res);
+	destroy_bench_surface(surface);
+}
+
+static void bench_image(struct bench_options *opts, int width, int height,
+		enum background_mode mode, const char *name, cairo_surface_t *image) {
+	cairo_surface_t *target =
+		cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	cairo_t *cairo = cairo_create(target);
+
+	struct bench_result res = {0};
+	while (!bench_done(opts, &res)) {
+		uint64_t start, allocs = alloc_count, bytes = alloc_bytes;
+		begin_frame(&start);
+		render_background_image(cairo, image, mode, width, height);
+		cairo_surface_flush(target);
+		end_frame(&res, start, allocs, bytes);
+	}
+	print_result("image", name, width, height, 1, &res);
+
+	cairo_destroy(cairo);
+	cairo_surface_destroy(target);
+}
+
+static void set_indicator_case(enum indicator_case c) {
+	state.auth_state = AUTH_STATE_IDLE;
+	state.input_state = INPUT_STATE_IDLE;
+	bench_xkb.caps_lock = false;
+	state.failed_attempts = 0;
+	state.args.indicator_idle_visible = true;
+	state.args.show_keyboard_layout = false;
+
+	switch (c) {
+	case INDICATOR_IDLE:
+		break;
+	case INDICATOR_TYPING:
+		state.input_state = INPUT_STATE_LETTER;
+		break;
+	case INDICATOR_BACKSPACE:
+		state.input_state = INPUT_STATE_BACKSPACE;
+		break;
+	case INDICATOR_CLEARED:
+		state.input_state = INPUT_STATE_CLEAR;
+		break;
+	case INDICATOR_VERIFYING:
+		state.auth_state = AUTH_STATE_VALIDATING;
+		break;
+	case INDICATOR_WRONG:
+		state.auth_state = AUTH_STATE_INVALID;
+		state.failed_attempts = 3;
+		break;
+	case INDICATOR_CAPS_LOCK:
+		state.input_state = INPUT_STATE_LETTER;
+		bench_xkb.caps_lock = true;
+		break;
+	case INDICATOR_LAYOUT:
+		state.input_state = INPUT_STATE_LETTER;
+		state.args.show_keyboard_layout = true;
+		break;
+	case INDICATOR_LAST:
+		assert(0);
+		break;
+	}
+}
+
+static void bench_indicator(struct bench_options *opts, int scale,
+		enum indicator_case c) {
+	set_indicator_case(c);
+	struct swaylock_surface *surface =
+		create_bench_surface(1920 / scale, 1080 / scale, scale, NULL);
+
+	struct bench_result res = {0};
+	while (!bench_done(opts, &res)) {
+		// Every keypress moves the highlight
+		state.highlight_start = (state.highlight_start + 700) % 2048;
+
+		uint64_t start, allocs = alloc_count, bytes = alloc_bytes;
+		begin_frame(&start);
+		render_frame(surface);
+		end_frame(&res, start, allocs, bytes);
+
+		sync_compositor();
+	}
+	print_result("indicator", indicator_case_names[c],
+		surface->width * scale, surface->height * scale, scale, &res);
+	destroy_bench_surface(surface);
+}
+
+// Largest difference per channel to the reference, whose circles cairo
+// draws at RING_SUPERSAMPLE times the size. Drawn at the size of the buffer,
+// cairo's 15 sample rows a pixel would be up to 1/30 off along flat edges.
+#define RING_MAX_DIFF 4
+#define RING_SUPERSAMPLE 4
+
+static bool bench_failed = false;
+
+struct ring_geometry {
+	double center, inner, outer, ring_inner, ring_outer;
+	double highlight_start, highlight_end, border;
+	int scale;
+};
+
+static struct ring_geometry get_ring_geometry(int scale, int highlight) {
+	int radius = state.args.radius * scale;
+	int thickness = state.args.thickness * scale;
+	double highlight_start = highlight * (M_PI / 1024.0);
+	return (struct ring_geometry){
+		.center = radius + thickness,
+		.inner = radius - thickness / 2,
+		.outer = radius + thickness / 2,
+		.ring_inner = radius - thickness / 2.0,
+		.ring_outer = radius + thickness / 2.0,
+		.highlight_start = highlight_start,
+		.highlight_end = highlight_start + M_PI / 3.0,
+		.border = M_PI / 128.0 * scale,
+		.scale = scale,
+	};
+}
+
+struct ring_colors {
+	uint32_t inside, ring, line, highlight, separator;
+};
+
+// The colors of the indicator in one of its states
+static const struct {
+	const char *name;
+	enum input_state input_state;
+	enum auth_state auth_state;
+} ring_states[] = {
+	{ "input", INPUT_STATE_LETTER, AUTH_STATE_IDLE },
+	{ "cleared", INPUT_STATE_CLEAR, AUTH_STATE_IDLE },
+	{ "verifying", INPUT_STATE_IDLE, AUTH_STATE_VALIDATING },
+	{ "wrong", INPUT_STATE_BACKSPACE, AUTH_STATE_INVALID },
+};
+
+static uint32_t pick_color(const struct swaylock_colorset *colorset,
+		size_t i) {
+	switch (ring_states[i].auth_state) {
+	case AUTH_STATE_VALIDATING:
+		return colorset->verifying;
+	case AUTH_STATE_INVALID:
+		return colorset->wrong;
+	default:
+		return ring_states[i].input_state == INPUT_STATE_CLEAR ?
+			colorset->cleared : colorset->input;
+	}
+}
+
+static struct ring_colors get_ring_colors(size_t i) {
+	struct swaylock_colors *colors = &state.args.colors;
+	return (struct ring_colors){
+		.inside = pick_color(&colors->inside, i),
+		.ring = pick_color(&colors->ring, i),
+		.line = pick_color(&colors->line, i),
+		.highlight = ring_states[i].input_state == INPUT_STATE_BACKSPACE ?
+			colors->bs_highlight : colors->key_highlight,
+		.separator = colors->separator,
+	};
+}
+
+// Highlights around the ring, in the units of the render snapshot. The last
+// one wraps around past zero.
+static const int ring_highlights[] = { 0, 300, 700, 1100, 1900 };
+
+// How the indicator buffer is oriented for some output transforms, like
+// get_buffer_matrix() in render.c does for a square buffer
+static const struct {
+	const char *name;
+	double xx, yx, xy, yy, x0, y0; // x0 and y0 in buffer sizes
+} ring_transforms[] = {
+	{ "normal", 1, 0, 0, 1, 0, 0 },
+	{ "90", 0, -1, 1, 0, 0, 1 },
+	{ "flipped", -1, 0, 0, 1, 1, 0 },
+	{ "flipped-90", 0, 1, 1, 0, 0, 0 },
+};
+
+static void get_ring_matrix(size_t i, int size, cairo_matrix_t *matrix) {
+	cairo_matrix_init(matrix, ring_transforms[i].xx, ring_transforms[i].yx,
+		ring_transforms[i].xy, ring_transforms[i].yy,
+		ring_transforms[i].x0 * size, ring_transforms[i].y0 * size);
+}
+
+// The circles of the typing indicator, the way render.c used to draw them
+static void draw_ring_cairo(cairo_t *cairo, const struct ring_geometry *g,
+		const struct ring_colors *colors) {
+	double radius = (g->ring_inner + g->ring_outer) / 2;
+	cairo_arc(cairo, g->center, g->center, g->inner, 0, 2 * M_PI);
+	cairo_set_source_u32(cairo, colors->inside);
+	cairo_fill(cairo);
+
+	cairo_set_line_width(cairo, g->ring_outer - g->ring_inner);
+	cairo_arc(cairo, g->center, g->center, radius, 0, 2 * M_PI);
+	cairo_set_source_u32(cairo, colors->ring);
+	cairo_stroke(cairo);
+	cairo_arc(cairo, g->center, g->center, radius,
+		g->highlight_start, g->highlight_end);
+	cairo_set_source_u32(cairo, colors->highlight);
+	cairo_stroke(cairo);
+	cairo_set_source_u32(cairo, colors->separator);
+	cairo_arc(cairo, g->center, g->center, radius,
+		g->highlight_start, g->highlight_start + g->border);
+	cairo_stroke(cairo);
+	cairo_arc(cairo, g->center, g->center, radius,
+		g->highlight_end, g->highlight_end + g->border);
+	cairo_stroke(cairo);
+
+	cairo_set_source_u32(cairo, colors->line);
+	cairo_set_line_width(cairo, 2.0 * g->scale);
+	cairo_arc(cairo, g->center, g->center, g->inner, 0, 2 * M_PI);
+	cairo_stroke(cairo);
+	cairo_arc(cairo, g->center, g->center, g->outer, 0, 2 * M_PI);
+	cairo_stroke(cairo);
+}
+
+// One of the shapes the indicator circles are made of, as the rasterizer
+// draws them
+struct ring_part {
+	double r0, r1;
+	bool arc;
+	double start, end;
+	uint32_t color;
+};
+
+#define RING_PARTS 7
+
+static void get_ring_parts(const struct ring_geometry *g,
+		const struct ring_colors *colors, struct ring_part parts[RING_PARTS]) {
+	double ring_inner = g->ring_inner, ring_outer = g->ring_outer;
+	parts[0] = (struct ring_part){ 0, g->inner, false, 0, 0, colors->inside };
+	parts[1] = (struct ring_part){
+		ring_inner, ring_outer, false, 0, 0, colors->ring };
+	parts[2] = (struct ring_part){ ring_inner, ring_outer, true,
+		g->highlight_start, g->highlight_end, colors->highlight };
+	parts[3] = (struct ring_part){ ring_inner, ring_outer, true,
+		g->highlight_start, g->highlight_start + g->border,
+		colors->separator };
+	parts[4] = (struct ring_part){ ring_inner, ring_outer, true,
+		g->highlight_end, g->highlight_end + g->border, colors->separator };
+	parts[5] = (struct ring_part){ g->inner - g->scale, g->inner + g->scale,
+		false, 0, 0, colors->line };
+	parts[6] = (struct ring_part){ g->outer - g->scale, g->outer + g->scale,
+		false, 0, 0, colors->line };
+}
+
+static void draw_ring_raster(cairo_surface_t *target,
+		const struct ring_geometry *g, const struct ring_colors *colors,
+		const cairo_matrix_t *matrix) {
+	struct ring_raster_target ring = {
+		.data = cairo_image_surface_get_data(target),
+		.width = cairo_image_surface_get_width(target),
+		.height = cairo_image_surface_get_height(target),
+		.stride = cairo_image_surface_get_stride(target),
+	};
+	struct ring_part parts[RING_PARTS];
+	get_ring_parts(g, colors, parts);
+	double cx = g->center, cy = g->center;
+	cairo_matrix_transform_point(matrix, &cx, &cy);
+	cairo_surface_flush(target);
+	for (int i = 0; i < RING_PARTS; ++i) {
+		const struct ring_part *part = &parts[i];
+		if (part->arc) {
+			ring_raster_arc_transformed(&ring, matrix, cx, cy,
+				part->r0, part->r1, part->start, part->end, part->color);
+		} else {
+			ring_raster_annulus(&ring, cx, cy, part->r0, part->r1,
+				part->color);
+		}
+	}
+	cairo_surface_mark_dirty(target);
+}
+
+static void clear_surface(cairo_surface_t *surface) {
+	cairo_surface_flush(surface);
+	memset(cairo_image_surface_get_data(surface), 0,
+		(size_t)cairo_image_surface_get_stride(surface) *
+		cairo_image_surface_get_height(surface));
+	cairo_surface_mark_dirty(surface);
+}
+
+// Largest difference between two images, channel by channel
+static int get_ring_diff(cairo_surface_t *a, cairo_surface_t *b,
+		int size, uint64_t *diff_pixels) {
+	cairo_surface_flush(a);
+	cairo_surface_flush(b);
+	int stride = cairo_image_surface_get_stride(a);
+	const uint8_t *pa = cairo_image_surface_get_data(a);
+	const uint8_t *pb = cairo_image_surface_get_data(b);
+	int max_diff = 0;
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			int pixel_diff = 0;
+			for (int c = 0; c < 4; ++c) {
+				int diff = abs(pa[y * stride + x * 4 + c] -
+					pb[y * stride + x * 4 + c]);
+				pixel_diff = diff > pixel_diff ? diff : pixel_diff;
+			}
+			max_diff = pixel_diff > max_diff ? pixel_diff : max_diff;
+			*diff_pixels += pixel_diff > 0;
+		}
+	}
+	return max_diff;
+}
+
+struct ring_reference {
+	cairo_surface_t *fine; // A8, RING_SUPERSAMPLE times the size
+	cairo_surface_t *mask; // A8, scaled down from fine
+};
+
+static void scale_down_mask(struct ring_reference *ref) {
+	cairo_surface_flush(ref->fine);
+	cairo_surface_flush(ref->mask);
+	int size = cairo_image_surface_get_width(ref->mask);
+	int fine_stride = cairo_image_surface_get_stride(ref->fine);
+	int stride = cairo_image_surface_get_stride(ref->mask);
+	const uint8_t *fine = cairo_image_surface_get_data(ref->fine);
+	uint8_t *mask = cairo_image_surface_get_data(ref->mask);
+	int n = RING_SUPERSAMPLE * RING_SUPERSAMPLE;
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			int sum = 0;
+			for (int j = 0; j < RING_SUPERSAMPLE; ++j) {
+				const uint8_t *row = fine +
+					(y * RING_SUPERSAMPLE + j) * fine_stride;
+				for (int i = 0; i < RING_SUPERSAMPLE; ++i) {
+					sum += row[x * RING_SUPERSAMPLE + i];
+				}
+			}
+			mask[y * stride + x] = (sum + n / 2) / n;
+		}
+	}
+	cairo_surface_mark_dirty(ref->mask);
+}
+
+// Composites a part with its coverage drawn by cairo, so that the parts
+// blend the way they do with the rasterizer
+static void draw_ring_part_reference(cairo_t *cairo,
+		struct ring_reference *ref, const struct ring_geometry *g,
+		const cairo_matrix_t *matrix, const struct ring_part *part) {
+	clear_surface(ref->fine);
+	cairo_t *fine = cairo_create(ref->fine);
+	// The default is a tenth of a pixel, too coarse for a reference
+	cairo_set_tolerance(fine, 0.01);
+	cairo_scale(fine, RING_SUPERSAMPLE, RING_SUPERSAMPLE);
+	cairo_transform(fine, matrix);
+	double c = g->center;
+	if (part->arc) {
+		cairo_arc(fine, c, c, part->r1, part->start, part->end);
+		cairo_arc_negative(fine, c, c, part->r0, part->end, part->start);
+	} else {
+		cairo_arc(fine, c, c, part->r1, 0, 2 * M_PI);
+		if (part->r0 > 0) {
+			cairo_new_sub_path(fine);
+			cairo_arc_negative(fine, c, c, part->r0, 2 * M_PI, 0);
+		}
+	}
+	cairo_fill(fine);
+	cairo_destroy(fine);
+
+	scale_down_mask(ref);
+	cairo_set_source_u32(cairo, part->color);
+	cairo_mask_surface(cairo, ref->mask, 0, 0);
+}
+
+// Compares the rasterizer with cairo in every indicator state, for several
+// highlights and buffer transforms
+static void check_ring(int scale) {
+	int size = 2 * get_ring_geometry(scale, 0).center;
+	cairo_surface_t *surfaces[2];
+	for (int i = 0; i < 2; ++i) {
+		surfaces[i] = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			size, size);
+	}
+	struct ring_reference ref = {
+		.fine = cairo_image_surface_create(CAIRO_FORMAT_A8,
+			size * RING_SUPERSAMPLE, size * RING_SUPERSAMPLE),
+		.mask = cairo_image_surface_create(CAIRO_FORMAT_A8, size, size),
+	};
+	cairo_t *cairo = cairo_create(surfaces[0]);
+
+	size_t n_states = sizeof(ring_states) / sizeof(ring_states[0]);
+	size_t n_highlights = sizeof(ring_highlights) / sizeof(ring_highlights[0]);
+	size_t n_transforms = sizeof(ring_transforms) / sizeof(ring_transforms[0]);
+	int max_diff = 0, cases = 0;
+	uint64_t diff_pixels = 0;
+	for (size_t t = 0; t < n_transforms; ++t) {
+		cairo_matrix_t matrix;
+		get_ring_matrix(t, size, &matrix);
+		for (size_t i = 0; i < n_states; ++i) {
+			struct ring_colors colors = get_ring_colors(i);
+			for (size_t h = 0; h < n_highlights; ++h) {
+				struct ring_geometry g =
+					get_ring_geometry(scale, ring_highlights[h]);
+				struct ring_part parts[RING_PARTS];
+				get_ring_parts(&g, &colors, parts);
+				clear_surface(surfaces[0]);
+				clear_surface(surfaces[1]);
+				for (int p = 0; p < RING_PARTS; ++p) {
+					draw_ring_part_reference(cairo, &ref, &g, &matrix,
+						&parts[p]);
+				}
+				draw_ring_raster(surfaces[1], &g, &colors, &matrix);
+				int diff = get_ring_diff(surfaces[0], surfaces[1], size,
+					&diff_pixels);
+				if (diff > RING_MAX_DIFF) {
+					swaylock_log(LOG_ERROR, "Ring differs by %d at scale %d, "
+						"%s, highlight at %d, %s transform", diff, scale,
+						ring_states[i].name, ring_highlights[h],
+						ring_transforms[t].name);
+				}
+				max_diff = diff > max_diff ? diff : max_diff;
+				++cases;
+			}
+		}
+	}
+
+	bool ok = max_diff <= RING_MAX_DIFF;
+	if (!ok) {
+		bench_failed = true;
+	}
+	printf("{\"group\":\"ring\",\"variant\":\"diff\","
+		"\"width\":%d,\"height\":%d,\"scale\":%d,\"cases\":%d,"
+		"\"max_diff\":%d,\"diff_pixels\":%llu,\"ok\":%s}\n",
+		size, size, scale, cases, max_diff,
+		(unsigned long long)diff_pixels, ok ? "true" : "false");
+	fflush(stdout);
+	cairo_destroy(cairo);
+	cairo_surface_destroy(ref.fine);
+	cairo_surface_destroy(ref.mask);
+	cairo_surface_destroy(surfaces[0]);
+	cairo_surface_destroy(surfaces[1]);
+}
+
+static void bench_ring(struct bench_options *opts, int scale) {
+	struct ring_geometry g = get_ring_geometry(scale, 700);
+	struct ring_colors colors = get_ring_colors(0);
+	cairo_matrix_t identity;
+	cairo_matrix_init_identity(&identity);
+	int size = 2 * g.center;
+	cairo_surface_t *surfaces[2];
+	for (int i = 0; i < 2; ++i) {
+		surfaces[i] = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			size, size);
+	}
+	cairo_t *cairo = cairo_create(surfaces[0]);
+	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
+
+	struct bench_result res = {0};
+	while (!bench_done(opts, &res)) {
+		clear_surface(surfaces[0]);
+		uint64_t start, allocs = alloc_count, bytes = alloc_bytes;
+		begin_frame(&start);
+		draw_ring_cairo(cairo, &g, &colors);
+		cairo_surface_flush(surfaces[0]);
+		end_frame(&res, start, allocs, bytes);
+	}
+	print_result("ring", "cairo", size, size, scale, &res);
+
+	res = (struct bench_result){0};
+	while (!bench_done(opts, &res)) {
+		clear_surface(surfaces[1]);
+		uint64_t start, allocs = alloc_count, bytes = alloc_bytes;
+		begin_frame(&start);
+		draw_ring_raster(surfaces[1], &g, &colors, &identity);
+		end_frame(&res, start, allocs, bytes);
+	}
+	print_result("ring", "raster", size, size, scale, &res);
+
+	cairo_destroy(cairo);
+	cairo_surface_destroy(surfaces[0]);
+	cairo_surface_destroy(surfaces[1]);
+	check_ring(scale);
+}
+
+static bool size_matches(struct bench_options *opts, int width, int height) {
+	if (!opts->size) {
+		return true;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%dx%d", width, height);
+	return strcmp(buf, opts->size) == 0;
+}
+
+static bool group_matches(struct bench_options *opts, const char *group) {
+	return !opts->group || strcmp(opts->group, group) == 0;
+}
+
+static void run_benchmarks(struct bench_options *opts, cairo_surface_t *image) {
+	size_t n_sizes = sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+	size_t n_scales = sizeof(bench_scales) / sizeof(bench_scales[0]);
+	size_t n_modes = sizeof(bench_modes) / sizeof(bench_modes[0]);
+
+	for (size_t m = 0; m < n_modes; ++m) {
+		if (opts->mode && strcmp(opts->mode, bench_modes[m].name) != 0) {
+			continue;
+		}
+		for (size_t i = 0; i < n_sizes; ++i) {
+			int width = bench_sizes[i].width, height = bench_sizes[i].height;
+			if (!size_matches(opts, width, height)) {
+				continue;
+			}
+			if (group_matches(opts, "image") &&
+					bench_modes[m].mode != BACKGROUND_MODE_SOLID_COLOR) {
+				bench_image(opts, width, height, bench_modes[m].mode,
+					bench_modes[m].name, image);
+			}
+			if (!group_matches(opts, "background")) {
+				continue;
+			}
+			for (size_t s = 0; s < n_scales; ++s) {
+				if (opts->scale && opts->scale != bench_scales[s]) {
+					continue;
+				}
+				bench_background(opts, width, height, bench_scales[s],
+					bench_modes[m].mode, bench_modes[m].name, image);
+			}
+		}
+	}
+
+	for (size_t s = 0; s < n_scales && group_matches(opts, "ring"); ++s) {
+		if (!opts->scale || opts->scale == bench_scales[s]) {
+			bench_ring(opts, bench_scales[s]);
+		}
+	}
+
+	if (!group_matches(opts, "indicator")) {
+		return;
+	}
+	for (enum indicator_case c = 0; c < INDICATOR_LAST; ++c) {
+		if (opts->indicator &&
+				strcmp(opts->indicator, indicator_case_names[c]) != 0) {
+			continue;
+		}
+		for (size_t s = 0; s < n_scales; ++s) {
+			if (opts->scale && opts->scale != bench_scales[s]) {
+				continue;
+			}
+			bench_indicator(opts, bench_scales[s], c);
+		}
+	}
+}
+
+static int parse_options(int argc, char **argv, struct bench_options *opts) {
+	static struct option long_options[] = {
+		{"debug", no_argument, NULL, 'd'},
+		{"group", required_argument, NULL, 'g'},
+		{"help", no_argument, NULL, 'h'},
+		{"image", required_argument, NULL, 'i'},
+		{"indicator", required_argument, NULL, 'I'},
+		{"low-memory", no_argument, NULL, 'L'},
+		{"min-frames", required_argument, NULL, 'n'},
+		{"min-time", required_argument, NULL, 't'},
+		{"mode", required_argument, NULL, 'm'},
+		{"scale", required_argument, NULL, 's'},
+		{"size", required_argument, NULL, 'S'},
+		{0, 0, 0, 0}
+	};
+
+	const char usage[] =
+		"Usage: swaylock-bench [options...]\n"
+		"\n"
+		"  -d, --debug                Enable debugging output.\n"
+		"  -g, --group <group>        Only run one of background, image, "
+			"ring, indicator.\n"
+		"  -h, --help                 Show help message and quit.\n"
+		"  -i, --image <path>         Background image to use instead of "
+			"a generated one.\n"
+		"  -I, --indicator <state>    Only run one indicator state.\n"
+		"  -L, --low-memory           Draw opaque backgrounds as RGB565.\n"
+		"  -n, --min-frames <n>       Minimum frames per case (default 5).\n"
+		"  -t, --min-time <ms>        Minimum time per case (default 250).\n"
+		"  -m, --mode <mode>          Only run one background mode.\n"
+		"  -s, --scale <scale>        Only run one output scale.\n"
+		"  -S, --size <WxH>           Only run one output size.\n"
+		"\n"
+		"Results are written to stdout as one JSON object per line.\n";
+
+	int c;
+	while ((c = getopt_long(argc, argv, "dg:hi:I:Ln:t:m:s:S:",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			swaylock_log_init(LOG_DEBUG);
+			break;
+		case 'g':
+			opts->group = optarg;
+			break;
+		case 'i':
+			opts->image_path = optarg;
+			break;
+		case 'I':
+			opts->indicator = optarg;
+			break;
+		case 'L':
+			opts->low_memory = true;
+			break;
+		case 'n':
+			opts->min_frames = atoi(optarg);
+			break;
+		case 't':
+			opts->min_time_ms = atoi(optarg);
+			break;
+		case 'm':
+			opts->mode = optarg;
+			break;
+		case 's':
+			opts->scale = atoi(optarg);
+			break;
+		case 'S':
+			opts->size = optarg;
+			break;
+		case 'h':
+			fprintf(stdout, "%s", usage);
+			exit(EXIT_SUCCESS);
+		default:
+			fprintf(stderr, "%s", usage);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	swaylock_log_init(LOG_ERROR);
+
+	struct bench_options opts = {
+		.min_time_ms = 250,
+		.min_frames = 5,
+	};
+	if (parse_options(argc, argv, &opts) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	compositor = bench_compositor_create();
+	if (!compositor || !bench_compositor_start_thread(compositor)) {
+		swaylock_log(LOG_ERROR, "Failed to start the compositor");
+		return EXIT_FAILURE;
+	}
+	int fd = bench_compositor_connect(compositor);
+	state.display = fd >= 0 ? wl_display_connect_to_fd(fd) : NULL;
+	if (!state.display) {
+		swaylock_log(LOG_ERROR, "Failed to connect to the compositor");
+		return EXIT_FAILURE;
+	}
+
+	struct wl_registry *registry = wl_display_get_registry(state.display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+	sync_compositor();
+	sync_compositor(); // for the wl_shm formats
+	if (!state.compositor || !state.subcompositor || !state.shm) {
+		swaylock_log(LOG_ERROR, "Compositor is missing globals");
+		return EXIT_FAILURE;
+	}
+
+	state.args = (struct swaylock_args){
+		.mode = BACKGROUND_MODE_FILL,
+		.font = strdup("sans-serif"),
+		.radius = 50,
+		.thickness = 10,
+		.show_indicator = true,
+		.show_caps_lock_text = true,
+		.show_failed_attempts = true,
+		.indicator_idle_visible = true,
+		.ready_fd = -1,
+		.low_memory = opts.low_memory,
+	};
+	set_bench_colors(&state.args.colors);
+	wl_list_init(&state.surfaces);
+	wl_list_init(&state.images);
+	// Text is drawn the way swaylock does it
+	font_warm_up_start(&state.font, state.args.font);
+	text_atlas_cache_init(&state.text_atlases);
+
+	state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	bench_xkb.keymap = xkb_keymap_new_from_names(state.xkb_context, NULL,
+		XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (!bench_xkb.keymap) {
+		swaylock_log(LOG_ERROR, "Failed to compile the default keymap");
+		return EXIT_FAILURE;
+	}
+	bench_xkb.state = xkb_state_new(bench_xkb.keymap);
+	bench_xkb.layout_name = xkb_keymap_layout_get_name(bench_xkb.keymap, 0);
+	state.xkb = &bench_xkb;
+
+	state.test_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 1, 1);
+	state.test_cairo = cairo_create(state.test_surface);
+
+	cairo_surface_t *image = opts.image_path ?
+		load_background_image(opts.image_path) : create_test_image();
+	if (!image) {
+		return EXIT_FAILURE;
+	}
+
+	run_benchmarks(&opts, image);
+
+	cairo_surface_destroy(image);
+	cairo_destroy(state.test_cairo);
+	cairo_surface_destroy(state.test_surface);
+	xkb_state_unref(bench_xkb.state);
+	xkb_keymap_unref(bench_xkb.keymap);
+	xkb_context_unref(state.xkb_context);
+	text_atlas_cache_finish(&state.text_atlases);
+	font_finish(&state.font);
+	free(state.args.font);
+	wl_registry_destroy(registry);
+	wl_display_disconnect(state.display);
+	bench_compositor_destroy(compositor);
+	return bench_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,107 +1,311 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // for secure_getenv
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "comm.h"
+#include "config.h"
 #include "log.h"
 #include "swaylock.h"
 #include "password-buffer.h"
 
+extern char **environ;
+
 static int comm[2][2] = {{-1, -1}, {-1, -1}};
 
-ssize_t read_comm_request(char **buf_ptr) {
-	size_t size;
-	ssize_t amt;
-	amt = read(comm[0][0], &size, sizeof(size));
-	if (amt == 0) {
-		return 0;
-	} else if (amt < 0) {
-		swaylock_log_errno(LOG_ERROR, "read pw request");
-		return -1;
+static char *shared = NULL;
+static struct {
+	uint32_t id; // 0 if free
+	size_t len;
+} shared_slots[COMM_SHARED_SLOTS];
+
+static uint32_t next_request_id = 1;
+
+// Partially read reply
+static uint8_t reply_buf[COMM_REPLY_SIZE];
+static size_t reply_len = 0;
+
+static bool set_nonblock(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		swaylock_log_errno(LOG_ERROR, "failed to make pipe nonblocking");
+		return false;
 	}
-	swaylock_log(LOG_DEBUG, "received pw check request");
-	char *buf = password_buffer_create(size);
-	if (!buf) {
+	return true;
+}
+
+// Moves fd out of the way of the fixed numbers swaylock-auth expects, so that
+// setting those up can't clobber one of the others
+static int move_fd(int fd) {
+	if (fd < 0) {
 		return -1;
 	}
-	size_t offs = 0;
-	do {
-		amt = read(comm[0][0], &buf[offs], size - offs);
-		if (amt <= 0) {
-			swaylock_log_errno(LOG_ERROR, "failed to read pw");
-			return -1;
-		}
-		offs += (size_t)amt;
-	} while (offs < size);
-
-	*buf_ptr = buf;
-	return size;
+	int moved = fcntl(fd, F_DUPFD_CLOEXEC, COMM_SHARED_FD + 1);
+	close(fd);
+	return moved;
 }
 
-bool write_comm_reply(bool success) {
-	if (write(comm[1][1], &success, sizeof(success)) != sizeof(success)) {
-		swaylock_log_errno(LOG_ERROR, "failed to write pw check result");
-		return false;
+static const char *get_helper_path(void) {
+#if HAVE_AUTH_HELPER_ENV && HAVE_SECURE_GETENV
+	// Whatever the helper is receives the password, so this is only honored
+	// by development builds, and never when swaylock is setuid
+	const char *path = secure_getenv("SWAYLOCK_AUTH_HELPER");
+	if (path && path[0]) {
+		return path;
 	}
-	return true;
+#endif
+	return SWAYLOCK_AUTH_HELPER;
 }
 
 bool spawn_comm_child(void) {
-	if (pipe(comm[0]) != 0) {
+	int shared_fd = -1;
+	shared = password_buffer_create_shared(COMM_SHARED_SIZE, &shared_fd);
+	if (!shared) {
+		swaylock_log(LOG_DEBUG, "Sending passwords through the pipe");
+	}
+	int request[2], reply[2];
+	if (pipe(request) != 0) {
 		swaylock_log_errno(LOG_ERROR, "failed to create pipe");
 		return false;
 	}
-	if (pipe(comm[1]) != 0) {
+	if (pipe(reply) != 0) {
 		swaylock_log_errno(LOG_ERROR, "failed to create pipe");
+		close(request[0]);
+		close(request[1]);
 		return false;
 	}
-	pid_t child = fork();
-	if (child < 0) {
-		swaylock_log_errno(LOG_ERROR, "failed to fork");
+	// Everything is close-on-exec, except for what's duplicated below
+	for (int i = 0; i < 2; ++i) {
+		request[i] = move_fd(request[i]);
+		reply[i] = move_fd(reply[i]);
+	}
+	shared_fd = move_fd(shared_fd);
+	if (request[0] < 0 || request[1] < 0 || reply[0] < 0 || reply[1] < 0 ||
+			(shared && shared_fd < 0)) {
+		swaylock_log_errno(LOG_ERROR, "failed to set up pipes");
+		return false;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, request[0], COMM_REQUEST_FD);
+	posix_spawn_file_actions_adddup2(&actions, reply[1], COMM_REPLY_FD);
+	if (shared) {
+		posix_spawn_file_actions_adddup2(&actions, shared_fd, COMM_SHARED_FD);
+	}
+	// Don't pass on the signal setup of the event loop
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t none, all;
+	sigemptyset(&none);
+	sigfillset(&all);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &all);
+	posix_spawnattr_setflags(&attr,
+		POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	char verbosity[16];
+	snprintf(verbosity, sizeof(verbosity), "%d", swaylock_log_get_verbosity());
+	char *argv[] = {
+		"swaylock-auth", "-v", verbosity, shared ? "-s" : NULL, NULL,
+	};
+	const char *path = get_helper_path();
+	pid_t child;
+	int ret = posix_spawn(&child, path, &actions, &attr, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	close(request[0]);
+	close(reply[1]);
+	if (shared_fd >= 0) {
+		close(shared_fd);
+	}
+	if (ret != 0) {
+		errno = ret;
+		swaylock_log_errno(LOG_ERROR, "failed to start %s", path);
+		close(request[1]);
+		close(reply[0]);
+		return false;
+	}
+	swaylock_log(LOG_DEBUG, "Started %s (pid %d)", path, (int)child);
+
+	comm[0][1] = request[1];
+	comm[1][0] = reply[0];
+	// The event loop must never wait for the child
+	return set_nonblock(comm[0][1]) && set_nonblock(comm[1][0]);
+}
+
+bool write_comm_password_hash(const char *hash) {
+	size_t len = strlen(hash) + 1;
+	if (len > COMM_MAX_PAYLOAD) {
+		swaylock_log(LOG_ERROR, "Password hash too long");
+		return false;
+	}
+	struct comm_header header = {
+		.version = COMM_PROTOCOL_VERSION,
+		.type = COMM_PASSWORD_HASH,
+		.len = len,
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &header, .iov_len = sizeof(header) },
+		{ .iov_base = (char *)hash, .iov_len = len },
+	};
+	ssize_t amt;
+	do {
+		amt = writev(comm[0][1], iov, 2);
+	} while (amt < 0 && errno == EINTR);
+	if (amt != (ssize_t)(sizeof(header) + len)) {
+		swaylock_log_errno(LOG_ERROR, "Failed to send password hash");
 		return false;
-	} else if (child == 0) {
-		close(comm[0][1]);
-		close(comm[1][0]);
-		run_pw_backend_child();
 	}
-	close(comm[0][0]);
-	close(comm[1][1]);
 	return true;
 }
 
-bool write_comm_request(struct swaylock_password *pw) {
-	bool result = false;
+static int get_free_shared_slot(void) {
+	if (!shared) {
+		return -1;
+	}
+	for (int i = 0; i < COMM_SHARED_SLOTS; ++i) {
+		if (shared_slots[i].id == 0) {
+			return i;
+		}
+	}
+	return -1; // the pipe still works
+}
+
+static void release_shared_slot(uint32_t id) {
+	for (int i = 0; shared && i < COMM_SHARED_SLOTS; ++i) {
+		if (shared_slots[i].id == id) {
+			clear_buffer(&shared[i * COMM_SHARED_SLOT_SIZE],
+				shared_slots[i].len);
+			shared_slots[i].id = 0;
+			return;
+		}
+	}
+}
+
+uint32_t write_comm_request(struct swaylock_password *pw) {
+	uint32_t id = 0;
 
 	size_t len = pw->len + 1;
-	size_t offs = 0;
-	if (write(comm[0][1], &len, sizeof(len)) < 0) {
-		swaylock_log_errno(LOG_ERROR, "Failed to request pw check");
+	if (len > COMM_MAX_PAYLOAD) {
+		swaylock_log(LOG_ERROR, "Password too long to be checked");
 		goto out;
 	}
 
+	struct comm_header header = {
+		.version = COMM_PROTOCOL_VERSION,
+		.type = COMM_AUTH_REQUEST,
+		.id = next_request_id,
+		.len = len,
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &header, .iov_len = sizeof(header) },
+		{ .iov_base = pw->buffer, .iov_len = len },
+	};
+	struct comm_doorbell bell;
+	int slot = get_free_shared_slot();
+	if (slot >= 0) {
+		bell.offset = slot * COMM_SHARED_SLOT_SIZE;
+		bell.len = len;
+		memcpy(&shared[bell.offset], pw->buffer, len);
+		header.type = COMM_AUTH_REQUEST_SHARED;
+		header.len = sizeof(bell);
+		iov[1] = (struct iovec){ .iov_base = &bell, .iov_len = sizeof(bell) };
+	}
+	ssize_t amt;
 	do {
-		ssize_t amt = write(comm[0][1], &pw->buffer[offs], len - offs);
-		if (amt < 0) {
-			swaylock_log_errno(LOG_ERROR, "Failed to write pw buffer");
-			goto out;
+		amt = writev(comm[0][1], iov, 2);
+	} while (amt < 0 && errno == EINTR);
+	if (amt < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			swaylock_log(LOG_ERROR, "Too many pw checks pending");
+		} else {
+			swaylock_log_errno(LOG_ERROR, "Failed to request pw check");
 		}
-		offs += amt;
-	} while (offs < len);
+		if (slot >= 0) {
+			clear_buffer(&shared[bell.offset], len);
+		}
+		goto out;
+	}
 
-	result = true;
+	if (slot >= 0) {
+		shared_slots[slot].id = next_request_id;
+		shared_slots[slot].len = len;
+	}
+	id = next_request_id++;
+	if (next_request_id == 0) {
+		next_request_id = 1; // 0 means failure
+	}
 
 out:
 	clear_password_buffer(pw);
-	return result;
+	return id;
+}
+
+bool write_comm_warm_up(void) {
+	struct comm_header header = {
+		.version = COMM_PROTOCOL_VERSION,
+		.type = COMM_WARM_UP,
+	};
+	ssize_t amt;
+	do {
+		amt = write(comm[0][1], &header, sizeof(header));
+	} while (amt < 0 && errno == EINTR);
+	if (amt != sizeof(header)) {
+		swaylock_log_errno(LOG_ERROR, "Failed to request auth warm-up");
+		return false;
+	}
+	return true;
 }
 
-bool read_comm_reply(void) {
-	bool result = false;
-	if (read(comm[1][0], &result, sizeof(result)) != sizeof(result)) {
-		swaylock_log_errno(LOG_ERROR, "Failed to read pw result");
-		result = false;
+int read_comm_reply(struct comm_reply *reply) {
+	while (reply_len < COMM_REPLY_SIZE) {
+		ssize_t amt = read(comm[1][0], &reply_buf[reply_len],
+			COMM_REPLY_SIZE - reply_len);
+		if (amt < 0) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			swaylock_log_errno(LOG_ERROR, "Failed to read pw result");
+			return -1;
+		} else if (amt == 0) {
+			swaylock_log(LOG_ERROR, "Auth child went away");
+			return -1;
+		}
+		reply_len += (size_t)amt;
 	}
-	return result;
+	reply_len = 0;
+
+	struct comm_header header;
+	struct comm_reply_payload payload;
+	memcpy(&header, reply_buf, sizeof(header));
+	memcpy(&payload, reply_buf + sizeof(header), sizeof(payload));
+	if (header.version != COMM_PROTOCOL_VERSION ||
+			header.type != COMM_AUTH_REPLY ||
+			header.len != sizeof(payload)) {
+		swaylock_log(LOG_ERROR, "Invalid pw result (version %u, type %u, "
+			"length %u)", header.version, header.type, header.len);
+		return -1;
+	}
+
+	release_shared_slot(header.id);
+	*reply = (struct comm_reply){
+		.id = header.id,
+		.success = payload.success != 0,
+		.status = payload.status,
+		.duration_ns = payload.duration_ns,
+	};
+	return 1;
 }
 
 int get_comm_reply_fd(void) {
@@ -8,6 +8,7 @@ complete -c swaylock -l config                 -s C --description "Path to the c
 complete -c swaylock -l daemonize              -s f --description "Detach from the controlling terminal after locking."
 complete -c swaylock -l debug                  -s d --description "Enable debugging output."
 complete -c swaylock -l disable-caps-lock-text -s L --description "Disable the Caps Lock text."
+complete -c swaylock -l fail-delay                  --description "Sets the delay before another attempt after a wrong password."
 complete -c swaylock -l font                        --description "Sets the font of the text."
 complete -c swaylock -l font-size                   --description "Sets a fixed font size for the indicator text."
 complete -c swaylock -l help                   -s h --description "Show help message and quit."
@@ -36,6 +37,7 @@ complete -c swaylock -l line-uses-inside       -s n --description "Use the insid
 complete -c swaylock -l line-uses-ring         -s r --description "Use the ring color for the line between the inside and ring."
 complete -c swaylock -l line-ver-color              --description "Sets the color of the line between the inside and ring when verifying."
 complete -c swaylock -l line-wrong-color            --description "Sets the color of the line between the inside and ring when invalid."
+complete -c swaylock -l low-memory                  --description "Use 16-bit buffers for opaque backgrounds."
 complete -c swaylock -l no-unlock-indicator    -s u --description "Disable the unlock indicator."
 complete -c swaylock -l ring-caps-lock-color        --description "Sets the color of the ring of the indicator when Caps Lock is active."
 complete -c swaylock -l ring-clear-color            --description "Sets the color of the ring of the indicator when cleared."
@@ -53,3 +55,4 @@ complete -c swaylock -l text-ver-color              --description "Sets the colo
 complete -c swaylock -l text-wrong-color            --description "Sets the color of the text when invalid."
 complete -c swaylock -l tiling                 -s t --description "Same as --scaling=tile."
 complete -c swaylock -l version                -s v --description "Show the version number and quit."
+complete -c swaylock -l warm-up-auth                --description "Prepare authentication at startup for a faster first attempt."
@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "font.h"
+#include "log.h"
+
+static void *font_warm_up(void *data) {
+	struct swaylock_font *font = data;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	font->face = cairo_toy_font_face_create(font->family,
+		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	// Toy faces are only matched against the installed fonts when they are
+	// first scaled, and the glyphs loaded when first measured
+	cairo_matrix_t size, ctm;
+	cairo_matrix_init_scale(&size, 16, 16);
+	cairo_matrix_init_identity(&ctm);
+	cairo_font_options_t *fo = cairo_font_options_create();
+	cairo_scaled_font_t *scaled =
+		cairo_scaled_font_create(font->face, &size, &ctm, fo);
+	cairo_text_extents_t extents;
+	cairo_scaled_font_text_extents(scaled,
+		"0123456789 Caps Lock Verifying Wrong Cleared", &extents);
+	cairo_status_t status = cairo_scaled_font_status(scaled);
+	cairo_scaled_font_destroy(scaled);
+	cairo_font_options_destroy(fo);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (status != CAIRO_STATUS_SUCCESS) {
+		swaylock_log(LOG_ERROR, "Unable to load font %s: %s", font->family,
+			cairo_status_to_string(status));
+	} else {
+		swaylock_log(LOG_DEBUG, "Resolved font %s in %.1f ms", font->family,
+			(end.tv_sec - start.tv_sec) * 1000.0 +
+			(end.tv_nsec - start.tv_nsec) / 1000000.0);
+	}
+	return NULL;
+}
+
+bool font_warm_up_start(struct swaylock_font *font, const char *family) {
+	font->family = strdup(family);
+	if (!font->family) {
+		return false;
+	}
+	pthread_mutex_init(&font->lock, NULL);
+
+	// Signals are for the main thread
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int err = pthread_create(&font->thread, NULL, font_warm_up, font);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err != 0) {
+		swaylock_log(LOG_ERROR, "Unable to start font warm-up thread: %s",
+			strerror(err));
+		pthread_mutex_destroy(&font->lock);
+		free(font->family);
+		font->family = NULL;
+		return false;
+	}
+	font->started = true;
+	return true;
+}
+
+cairo_font_face_t *font_get_face(struct swaylock_font *font) {
+	if (!font->started) {
+		return NULL;
+	}
+	pthread_mutex_lock(&font->lock);
+	if (!font->joined) {
+		pthread_join(font->thread, NULL);
+		font->joined = true;
+	}
+	pthread_mutex_unlock(&font->lock);
+	return font->face;
+}
+
+void font_finish(struct swaylock_font *font) {
+	if (!font->started) {
+		return;
+	}
+	font_get_face(font);
+	cairo_font_face_destroy(font->face);
+	pthread_mutex_destroy(&font->lock);
+	free(font->family);
+	*font = (struct swaylock_font){0};
+}
@@ -0,0 +1,42 @@
+#ifndef _SWAYLOCK_AUTH_H
+#define _SWAYLOCK_AUTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * swaylock-auth, the helper swaylock starts to check passwords. It only links
+ * the authentication backend, and talks to swaylock over the pipes and shared
+ * memory set up by spawn_comm_child().
+ */
+
+// A request as seen by swaylock-auth
+struct comm_request {
+	uint32_t id;
+	struct timespec received; // when the backend started on the request
+	bool shared; // the password is in memory shared with swaylock
+};
+
+// Picks up the fds passed by swaylock. Returns false if there are none.
+bool comm_child_init(bool shared);
+// Reads the next request, blocking. Returns the size of the password buffer,
+// 0 when swaylock went away, or -1 on error. Warm-up requests are handled
+// while waiting.
+ssize_t read_comm_request(struct comm_request *req, char **buf_ptr);
+// Releases the password buffer of a request once the backend is done with it.
+void release_comm_request(const struct comm_request *req, char *buf,
+	size_t size);
+bool write_comm_reply(const struct comm_request *req, bool success,
+	int32_t status);
+// Reads the hash sent with write_comm_password_hash(), into a password
+// buffer of *size bytes. Returns NULL on error.
+char *read_comm_password_hash(size_t *size);
+
+// Implemented by the backend
+void run_pw_backend_child(void);
+// Called before the first request, when enabled
+void warm_up_pw_backend(void);
+
+#endif
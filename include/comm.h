@@ -1,17 +1,89 @@
 #ifndef _SWAYLOCK_COMM_H
 #define _SWAYLOCK_COMM_H
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 struct swaylock_password;
 
+// Bumped on any change to the framing between swaylock and swaylock-auth
+#define COMM_PROTOCOL_VERSION 2
+
+/*
+ * Every message is a header followed by len bytes of payload. Both ends are
+ * built together and run on the same machine, so host byte order is used.
+ */
+enum comm_message_type {
+	COMM_AUTH_REQUEST = 1, // payload: NUL-terminated password
+	COMM_AUTH_REPLY = 2, // payload: struct comm_reply_payload
+	COMM_WARM_UP = 3, // no payload, no reply
+	COMM_AUTH_REQUEST_SHARED = 4, // payload: struct comm_doorbell
+	COMM_PASSWORD_HASH = 5, // payload: NUL-terminated crypt hash, no reply
+};
+
+struct comm_header {
+	uint16_t version;
+	uint16_t type;
+	uint32_t id;
+	uint32_t len;
+};
+
+// Where to find the password in the shared memory
+struct comm_doorbell {
+	uint32_t offset;
+	uint32_t len;
+};
+
+struct comm_reply_payload {
+	uint32_t success;
+	int32_t status;
+	uint64_t duration_ns;
+};
+
+#define COMM_REPLY_SIZE (sizeof(struct comm_header) + \
+	sizeof(struct comm_reply_payload))
+
+// Pipe writes up to PIPE_BUF bytes are atomic, so a request is either written
+// whole or not at all, even though the fd is nonblocking
+#define COMM_MAX_PAYLOAD (PIPE_BUF - sizeof(struct comm_header))
+
+// Passwords are handed over through memory shared with swaylock-auth when the
+// system supports it, so they never pass through the kernel. Each request
+// takes a slot until its reply arrives, when swaylock wipes it.
+#define COMM_SHARED_SLOTS 4
+#define COMM_SHARED_SLOT_SIZE PIPE_BUF
+#define COMM_SHARED_SIZE (COMM_SHARED_SLOTS * COMM_SHARED_SLOT_SIZE)
+
+// Where swaylock-auth finds its ends of the pipes and the shared memory
+#define COMM_REQUEST_FD 3
+#define COMM_REPLY_FD 4
+#define COMM_SHARED_FD 5
+
+// A reply as seen by swaylock
+struct comm_reply {
+	uint32_t id; // matches the value returned by write_comm_request()
+	bool success;
+	int32_t status; // backend specific, eg. the PAM return code
+	uint64_t duration_ns; // time the backend spent on the request
+};
+
+// Starts swaylock-auth. In builds with -Dauth-helper-env=true,
+// $SWAYLOCK_AUTH_HELPER overrides where it is looked up unless swaylock is
+// setuid.
 bool spawn_comm_child(void);
-ssize_t read_comm_request(char **buf_ptr);
-bool write_comm_reply(bool success);
-// Requests the provided password to be checked. The password is always cleared
-// when the function returns.
-bool write_comm_request(struct swaylock_password *pw);
-bool read_comm_reply(void);
+// Hands the shadow backend the hash to check against, before any request.
+bool write_comm_password_hash(const char *hash);
+// Requests the provided password to be checked, without blocking. Returns the
+// ID of the request, or 0 on failure. The password is always cleared when the
+// function returns.
+uint32_t write_comm_request(struct swaylock_password *pw);
+// Asks the auth child to prepare for the first request. There's no reply.
+bool write_comm_warm_up(void);
+// Reads a reply without blocking. Returns 1 if a reply was read, 0 if none is
+// available yet, or -1 if the auth child went away.
+int read_comm_reply(struct comm_reply *reply);
 // FD to poll for password authentication replies.
 int get_comm_reply_fd(void);
 
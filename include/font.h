@@ -0,0 +1,38 @@
+#ifndef _SWAYLOCK_FONT_H
+#define _SWAYLOCK_FONT_H
+#include <cairo/cairo.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * The font of the indicator text, resolved on a thread of its own while
+ * swaylock starts up. The first lookup initializes fontconfig and may scan
+ * its cache, which would otherwise happen while drawing the first frame.
+ */
+struct swaylock_font {
+	pthread_mutex_t lock;
+	pthread_t thread;
+	bool started;
+	bool joined; // protected by lock
+	char *family;
+	cairo_font_face_t *face; // set by the thread, read once joined
+};
+
+/**
+ * Start resolving the font family. Returns false if the thread couldn't be
+ * started, in which case the font is looked up when it's first drawn.
+ */
+bool font_warm_up_start(struct swaylock_font *font, const char *family);
+
+/**
+ * Get the resolved font face, waiting for the warm-up if it is still running.
+ * Safe to call from any thread. Returns NULL if no warm-up was started.
+ */
+cairo_font_face_t *font_get_face(struct swaylock_font *font);
+
+/**
+ * Wait for the warm-up, eg. before forking, and release the face.
+ */
+void font_finish(struct swaylock_font *font);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _SWAYLOCK_KEYMAP_CACHE_H
+#define _SWAYLOCK_KEYMAP_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+// Compositors send the same keymap to every seat, and again on some layout
+// changes. Compiling a multi-layout keymap takes tens of milliseconds.
+#define KEYMAP_CACHE_SIZE 4
+
+struct keymap_cache_entry {
+	uint64_t hash; // of the keymap text
+	size_t size;
+	char *text; // compared on a hash match, a wrong keymap locks the user out
+	struct xkb_keymap *keymap; // NULL if unused
+	uint64_t last_used;
+};
+
+struct keymap_cache {
+	struct keymap_cache_entry entries[KEYMAP_CACHE_SIZE];
+	uint64_t uses;
+};
+
+// Returns a new reference to the keymap compiled from text, which is only
+// compiled if it isn't in the cache yet. Returns NULL on failure.
+struct xkb_keymap *keymap_cache_get(struct keymap_cache *cache,
+	struct xkb_context *context, const char *text, size_t size);
+
+#endif
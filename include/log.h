@@ -14,6 +14,7 @@ enum log_importance {
 };
 
 void swaylock_log_init(enum log_importance verbosity);
+enum log_importance swaylock_log_get_verbosity(void);
 
 #ifdef __GNUC__
 #define _ATTRIB_PRINTF(start, end) __attribute__((format(printf, start, end)))
@@ -1,16 +1,44 @@
 #ifndef _SWAY_LOOP_H
 #define _SWAY_LOOP_H
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 /**
  * This is an event loop system designed for sway clients, not sway itself.
  *
- * The loop consists of file descriptors and timers. Typically the Wayland
- * display's file descriptor will be one of the fds in the loop.
+ * The loop consists of file descriptors, timers and signals. Typically the
+ * Wayland display's file descriptor will be one of the fds in the loop.
+ *
+ * On Linux the loop is backed by epoll, with a timerfd for the timers and a
+ * signalfd for the signals. Other systems fall back to poll().
  */
 
 struct loop;
-struct loop_timer;
+
+/**
+ * A timer, owned by the caller and typically embedded in a larger struct.
+ *
+ * Armed timers are kept in a heap inside the loop, so arming and disarming
+ * are O(log n) and only allocate when the heap has to grow. A zeroed timer is
+ * disarmed, but needs loop_timer_init before it can be armed.
+ */
+struct loop_timer {
+	void (*callback)(void *data);
+	void *data;
+	const char *name; // callback name, for profiling
+	struct timespec expiry;
+	int slack_ms;
+	size_t heap_index; // 1-based position in the loop's heap, 0 if disarmed
+};
+
+struct loop_stats {
+	uint64_t wakeups; // returns from epoll_wait() or poll()
+	uint64_t timer_wakeups; // wakeups which fired at least one timer
+	uint64_t timers_fired;
+	uint64_t fd_events;
+};
 
 /**
  * Create an event loop.
@@ -27,28 +55,94 @@ void loop_destroy(struct loop *loop);
  */
 void loop_poll(struct loop *loop);
 
+/**
+ * Get the wakeup counters of the loop since its creation.
+ */
+void loop_get_stats(struct loop *loop, struct loop_stats *stats);
+
+/**
+ * Record how long each callback and each loop iteration takes, and log the
+ * ones which take longer than stall_ms. Callbacks are identified by the name
+ * of their function.
+ */
+bool loop_enable_profiling(struct loop *loop, int stall_ms);
+
+/**
+ * Log a summary of the recorded profile, if profiling is enabled.
+ */
+void loop_log_profile(struct loop *loop);
+
 /**
  * Add a file descriptor to the loop.
  */
-void loop_add_fd(struct loop *loop, int fd, short mask,
-		void (*func)(int fd, short mask, void *data), void *data);
+void _loop_add_fd(struct loop *loop, int fd, short mask,
+		void (*func)(int fd, short mask, void *data), void *data,
+		const char *name);
+
+#define loop_add_fd(loop, fd, mask, func, data) \
+	_loop_add_fd(loop, fd, mask, func, data, #func)
+
+/**
+ * Set the callback of a timer. The timer must not be armed.
+ */
+void _loop_timer_init(struct loop_timer *timer,
+		void (*callback)(void *data), void *data, const char *name);
+
+#define loop_timer_init(timer, callback, data) \
+	_loop_timer_init(timer, callback, data, #callback)
 
 /**
- * Add a timer to the loop.
+ * Allow a timer to fire up to slack_ms late. Expiries are rounded up to a
+ * multiple of the slack, so timers with compatible slack share wakeups.
+ * Takes effect the next time the timer is armed.
+ */
+void loop_timer_set_slack(struct loop_timer *timer, int slack_ms);
+
+/**
+ * Arm a timer to expire in ms milliseconds, replacing any pending expiry.
  *
- * When the timer expires, the timer will be removed from the loop and freed.
+ * The timer is disarmed right before its callback runs.
  */
-struct loop_timer *loop_add_timer(struct loop *loop, int ms,
-		void (*callback)(void *data), void *data);
+void loop_timer_arm(struct loop *loop, struct loop_timer *timer, int ms);
 
 /**
- * Remove a file descriptor from the loop.
+ * Arm a timer to expire at an absolute CLOCK_MONOTONIC time, replacing any
+ * pending expiry. Expiries in the past fire on the next loop iteration.
  */
-bool loop_remove_fd(struct loop *loop, int fd);
+void loop_timer_arm_at(struct loop *loop, struct loop_timer *timer,
+		const struct timespec *expiry);
 
 /**
- * Remove a timer from the loop.
+ * Disarm a timer. Does nothing if the timer isn't armed.
+ */
+void loop_timer_disarm(struct loop *loop, struct loop_timer *timer);
+
+static inline bool loop_timer_is_armed(const struct loop_timer *timer) {
+	return timer->heap_index != 0;
+}
+
+/**
+ * Handle a signal in the loop.
+ *
+ * The callback runs from loop_poll rather than from a signal handler. On Linux
+ * the signal is blocked and read from a signalfd, elsewhere a self-pipe is
+ * used.
  */
-bool loop_remove_timer(struct loop *loop, struct loop_timer *timer);
+bool _loop_add_signal(struct loop *loop, int signo,
+		void (*callback)(int signo, void *data), void *data,
+		const char *name);
+
+#define loop_add_signal(loop, signo, callback, data) \
+	_loop_add_signal(loop, signo, callback, data, #callback)
+
+/**
+ * Change the events a file descriptor in the loop is polled for.
+ */
+bool loop_modify_fd(struct loop *loop, int fd, short mask);
+
+/**
+ * Remove a file descriptor from the loop.
+ */
+bool loop_remove_fd(struct loop *loop, int fd);
 
 #endif
@@ -1,9 +1,19 @@
 #ifndef _SWAY_PASSWORD_BUFFER_H
 #define _SWAY_PASSWORD_BUFFER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+void clear_buffer(char *buf, size_t size);
 char *password_buffer_create(size_t size);
 void password_buffer_destroy(char *buffer, size_t size);
+// Forked children get zeroed password buffers. Call with true around a fork
+// whose child carries on with the passwords, and with false after it.
+void password_buffer_keep_on_fork(bool keep);
+// Locked memory to share with another process, which maps *fd with
+// password_buffer_map_shared(). Returns NULL if the system doesn't support
+// it. It is never unmapped.
+char *password_buffer_create_shared(size_t size, int *fd);
+char *password_buffer_map_shared(int fd, size_t size);
 
 #endif
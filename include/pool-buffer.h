@@ -7,18 +7,33 @@
 
 struct pool_buffer {
 	struct wl_buffer *buffer;
+	struct wl_buffer *stale_buffer; // replaced by alloc_buffer, not yet destroyed
 	cairo_surface_t *surface;
 	cairo_t *cairo;
-	uint32_t width, height;
+	uint32_t width, height, stride;
+	uint32_t format;
 	void *data;
 	size_t size;
+	int fd; // shm fd, kept until the buffer is exported
+	bool has_fd;
 	bool busy;
 };
 
+/**
+ * Allocate the memory of a buffer and set up cairo, without making any
+ * Wayland requests. Safe to call from the render thread. If the buffer is
+ * already allocated with a different size or format, its memory is replaced.
+ * ARGB8888, XRGB8888 and RGB565 are supported.
+ */
+bool alloc_buffer(struct pool_buffer *buf, int32_t width, int32_t height,
+	uint32_t format);
+/**
+ * Create the wl_buffer for memory allocated by alloc_buffer, if needed.
+ */
+bool export_buffer(struct wl_shm *shm, struct pool_buffer *buf);
 struct pool_buffer *create_buffer(struct wl_shm *shm, struct pool_buffer *buf,
 	int32_t width, int32_t height, uint32_t format);
-struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-	struct pool_buffer pool[static 2], uint32_t width, uint32_t height);
+struct pool_buffer *get_free_buffer(struct pool_buffer pool[static 2]);
 void destroy_buffer(struct pool_buffer *buffer);
 
 #endif
@@ -0,0 +1,49 @@
+#ifndef _SWAYLOCK_RENDER_THREAD_H
+#define _SWAYLOCK_RENDER_THREAD_H
+#include <stdbool.h>
+
+struct swaylock_state;
+struct swaylock_render_job;
+
+/**
+ * A worker thread which rasterizes render jobs, so that drawing the indicator
+ * and scaling the background never blocks the Wayland thread.
+ *
+ * Jobs are passed in both directions through single-producer single-consumer
+ * rings: only the Wayland thread submits and collects, only the worker runs
+ * them. The worker doesn't make any Wayland requests; jobs are presented by
+ * the Wayland thread once they come back.
+ */
+struct render_thread;
+
+struct render_thread *render_thread_create(struct swaylock_state *state);
+/**
+ * Stop the worker. A job it's currently running is finished first, queued
+ * ones are dropped.
+ */
+void render_thread_destroy(struct render_thread *rt);
+
+/**
+ * Queue a job. Returns false if the queue is full, in which case the job is
+ * still owned by the caller.
+ */
+bool render_thread_submit(struct render_thread *rt,
+	struct swaylock_render_job *job);
+/**
+ * Get the next job the worker is done with, or NULL.
+ */
+struct swaylock_render_job *render_thread_pop_done(struct render_thread *rt);
+
+/**
+ * FD which becomes readable when jobs are done. Call render_thread_ack before
+ * popping them.
+ */
+int render_thread_get_fd(struct render_thread *rt);
+void render_thread_ack(struct render_thread *rt);
+
+/**
+ * Block until every submitted job is done, so that they can all be popped.
+ */
+void render_thread_wait(struct render_thread *rt);
+
+#endif
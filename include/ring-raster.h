@@ -0,0 +1,42 @@
+#ifndef _SWAYLOCK_RING_RASTER_H
+#define _SWAYLOCK_RING_RASTER_H
+#include <stdint.h>
+#include <cairo/cairo.h>
+
+/**
+ * Draws the shapes the indicator is made of, circles and arcs of a ring,
+ * straight into an image. Coverage is computed analytically from the
+ * distance to the edges, without going through a path and a scan
+ * converter, and pixels are composited with OVER a few at a time.
+ */
+struct ring_raster_target {
+	void *data; // premultiplied ARGB32, like cairo image surfaces
+	int width, height;
+	int stride; // in bytes
+};
+
+/**
+ * Fill the ring between radii r0 and r1 around cx, cy with a color in the
+ * 0xRRGGBBAA form of cairo_set_source_u32. A disk if r0 <= 0.
+ */
+void ring_raster_annulus(const struct ring_raster_target *target,
+	double cx, double cy, double r0, double r1, uint32_t color);
+
+/**
+ * Like ring_raster_annulus, limited to the angles from start to end, in
+ * radians as with cairo_arc. The arc must be shorter than half a turn.
+ */
+void ring_raster_arc(const struct ring_raster_target *target,
+	double cx, double cy, double r0, double r1,
+	double start, double end, uint32_t color);
+
+/**
+ * Like ring_raster_arc, with the angles given in a space which the matrix
+ * maps to the target, rotated or mirrored by a multiple of a right angle.
+ * The center is in target coordinates.
+ */
+void ring_raster_arc_transformed(const struct ring_raster_target *target,
+	const cairo_matrix_t *matrix, double cx, double cy, double r0, double r1,
+	double start, double end, uint32_t color);
+
+#endif
@@ -2,28 +2,33 @@
 #define _SWAYLOCK_SEAT_H
 #include <xkbcommon/xkbcommon.h>
 #include <stdint.h>
+#include <time.h>
 #include <stdbool.h>
+#include "keymap-cache.h"
+#include "loop.h"
 
-struct loop;
-struct loop_timer;
-
+// Keyboard state of one seat. Keymaps come from the keymap cache shared by
+// all seats, so seats with the same layout share the compiled keymap.
 struct swaylock_xkb {
 	bool caps_lock;
 	bool control;
 	struct xkb_state *state;
-	struct xkb_context *context;
 	struct xkb_keymap *keymap;
+	const char *layout_name; // of the active layout, owned by the keymap
 };
 
 struct swaylock_seat {
 	struct swaylock_state *state;
 	struct wl_pointer *pointer;
 	struct wl_keyboard *keyboard;
-	int32_t repeat_period_ms;
+	struct swaylock_xkb xkb;
+	int32_t repeat_rate; // keys per second, 0 if repeat is disabled
 	int32_t repeat_delay_ms;
 	uint32_t repeat_sym;
 	uint32_t repeat_codepoint;
-	struct loop_timer *repeat_timer;
+	struct timespec repeat_start; // when the first repeat of the key is due
+	uint64_t repeat_count; // repeats applied since repeat_start
+	struct loop_timer repeat_timer;
 };
 
 extern const struct wl_seat_listener seat_listener;
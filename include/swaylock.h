@@ -2,11 +2,14 @@
 #define _SWAYLOCK_H
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include <wayland-client.h>
 #include "background-image.h"
 #include "cairo.h"
+#include "font.h"
 #include "pool-buffer.h"
 #include "seat.h"
+#include "text-atlas.h"
 
 // Indicator state: status of authentication attempt
 enum auth_state {
@@ -69,6 +72,9 @@ struct swaylock_args {
 	bool daemonize;
 	int ready_fd;
 	bool indicator_idle_visible;
+	uint32_t fail_delay_ms; // back-off after the first failed attempt
+	bool warm_up_auth;
+	bool low_memory; // RGB565 for opaque backgrounds
 };
 
 struct swaylock_password {
@@ -77,31 +83,84 @@ struct swaylock_password {
 	char *buffer;
 };
 
+struct comm_reply;
+struct render_thread;
+
 struct swaylock_state {
 	struct loop *eventloop;
-	struct loop_timer *input_idle_timer; // timer to reset input state to IDLE
-	struct loop_timer *auth_idle_timer; // timer to stop displaying AUTH_STATE_INVALID
-	struct loop_timer *clear_password_timer;  // clears the password buffer
+	struct render_thread *render_thread; // NULL while rendering synchronously
+	struct loop_timer input_idle_timer; // timer to reset input state to IDLE
+	struct loop_timer auth_idle_timer; // timer to stop displaying AUTH_STATE_INVALID
+	struct loop_timer clear_password_timer;  // clears the password buffer
+	struct loop_timer auth_verifying_timer; // shows AUTH_STATE_VALIDATING
+	struct loop_timer auth_backoff_timer; // holds back attempts after a failure
 	struct wl_display *display;
 	struct wl_compositor *compositor;
 	struct wl_subcompositor *subcompositor;
 	struct wl_shm *shm;
+	struct wp_viewporter *viewporter;
+	struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+	bool shm_rgb565; // the compositor accepts RGB565 buffers
 	struct wl_list surfaces;
 	struct wl_list images;
 	struct swaylock_args args;
 	struct swaylock_password password;
-	struct swaylock_xkb xkb;
+	struct swaylock_password deferred_password; // submitted during back-off
+	bool auth_deferred;
+	struct xkb_context *xkb_context;
+	struct keymap_cache keymap_cache; // shared by all seats
+	// Keyboard state of the seat which last had input, shown by the indicator
+	struct swaylock_xkb *xkb;
+	struct swaylock_font font;
+	struct text_atlas_cache text_atlases;
 	cairo_surface_t *test_surface;
-	cairo_t *test_cairo; // used to estimate font/text sizes
+	cairo_t *test_cairo; // used to estimate font/text sizes on this thread
 	enum auth_state auth_state; // state of the authentication attempt
 	enum input_state input_state; // state of the password buffer and key inputs
 	uint32_t highlight_start; // position of highlight; 2048 = 1 full turn
 	int failed_attempts;
+	uint32_t auth_request_id; // latest password check, 0 if none pending
+	struct timespec auth_request_start;
+	uint32_t auth_latency_ms; // round trip of the last password check
 	bool run_display, locked;
+	uint64_t frames_rendered;
+	uint64_t frames_skipped; // nothing visible had changed
 	struct ext_session_lock_manager_v1 *ext_session_lock_manager_v1;
 	struct ext_session_lock_v1 *ext_session_lock_v1;
 };
 
+// Copy of everything a frame depends on that can change while locked, so that
+// it can be rendered away from the Wayland thread. Fields which wouldn't make
+// a visible difference are left zeroed.
+struct swaylock_render_snapshot {
+	bool show_indicator;
+	enum auth_state auth_state;
+	enum input_state input_state;
+	uint32_t highlight_start;
+	int failed_attempts;
+	bool caps_lock;
+	char layout[128]; // keyboard layout name, empty if not shown
+	uint32_t width, height;
+	double scale;
+	bool viewport; // fractional scale, buffers are sized with viewports
+	enum wl_output_subpixel subpixel;
+	enum wl_output_transform transform;
+};
+
+struct swaylock_render_job {
+	struct swaylock_surface *surface;
+	struct swaylock_render_snapshot snapshot;
+	cairo_surface_t *image;
+	bool background; // the background needs to be redrawn
+	uint32_t background_format; // wl_shm format of the background buffer
+	bool indicator; // the indicator looks different from the last frame
+	struct pool_buffer background_buffer;
+	struct pool_buffer *indicator_buffer; // NULL if none was free
+	int subsurf_x, subsurf_y;
+	int subsurf_width, subsurf_height;
+	bool background_ok, indicator_ok;
+};
+
 struct swaylock_surface {
 	cairo_surface_t *image;
 	struct swaylock_state *state;
@@ -110,17 +169,29 @@ struct swaylock_surface {
 	struct wl_surface *surface; // surface for background
 	struct wl_surface *child; // indicator surface made into subsurface
 	struct wl_subsurface *subsurface;
+	struct wp_viewport *viewport, *child_viewport; // NULL if unsupported
+	struct wp_fractional_scale_v1 *fractional_scale;
 	struct ext_session_lock_surface_v1 *ext_session_lock_surface_v1;
 	struct pool_buffer indicator_buffers[2];
 	bool created;
 	bool frame_pending, dirty;
+	bool render_due; // frame callback done while dirty, render after dispatch
+	bool render_pending; // render_job is owned by the render thread
+	struct swaylock_render_job render_job;
+	// Snapshot of the last indicator which was presented
+	struct swaylock_render_snapshot last_snapshot;
+	bool last_snapshot_valid;
 	uint32_t width, height;
 	int32_t scale;
+	uint32_t preferred_scale; // fractional scale in 120ths, 0 if none yet
 	enum wl_output_subpixel subpixel;
+	enum wl_output_transform transform; // buffers are drawn in this orientation
 	char *output_name;
 	struct wl_list link;
-	// Dimensions of last wl_buffer committed to background surface
+	// Size, before the transform, and transform of the last wl_buffer
+	// committed to background surface
 	int last_buffer_width, last_buffer_height;
+	enum wl_output_transform last_buffer_transform;
 };
 
 // There is exactly one swaylock_image for each -i argument
@@ -132,16 +203,27 @@ struct swaylock_image {
 };
 
 void swaylock_handle_key(struct swaylock_state *state,
-		xkb_keysym_t keysym, uint32_t codepoint);
+		const struct swaylock_xkb *xkb, xkb_keysym_t keysym, uint32_t codepoint);
+bool surface_is_opaque(struct swaylock_surface *surface);
 void render_frame_background(struct swaylock_surface *surface);
 void render_frame(struct swaylock_surface *surface);
+void render_job_prepare(struct swaylock_surface *surface,
+		struct swaylock_render_job *job, bool background, bool indicator);
+void render_job_run(struct swaylock_state *state,
+		struct swaylock_render_job *job, cairo_t *test_cairo);
+bool render_job_present(struct swaylock_render_job *job);
 void damage_surface(struct swaylock_surface *surface);
 void damage_state(struct swaylock_state *state);
+void render_due_frames(struct swaylock_state *state);
 void clear_password_buffer(struct swaylock_password *pw);
+void initialize_password_timers(struct swaylock_state *state);
 void schedule_auth_idle(struct swaylock_state *state);
+void handle_auth_reply(struct swaylock_state *state,
+		const struct comm_reply *reply);
 
 void initialize_pw_backend(int argc, char **argv);
-void run_pw_backend_child(void);
-void clear_buffer(char *buf, size_t size);
+// Default for --fail-delay, backends which already hold back failed
+// attempts don't need another delay on top
+extern const uint32_t pw_backend_fail_delay_ms;
 
 #endif
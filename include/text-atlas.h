@@ -0,0 +1,56 @@
+#ifndef _SWAYLOCK_TEXT_ATLAS_H
+#define _SWAYLOCK_TEXT_ATLAS_H
+#include <cairo/cairo.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * The indicator only ever shows a handful of short strings. Rather than
+ * going through cairo's text API on every frame, the printable ASCII glyphs
+ * of the font are rasterized once per size into an atlas, along with their
+ * metrics, and text is drawn by masking the text color with the atlas.
+ *
+ * Text with characters outside of the atlas, eg. some layout names, has to
+ * be drawn through cairo instead.
+ */
+#define TEXT_ATLAS_CACHE_SIZE 4
+
+struct text_atlas;
+
+struct text_atlas_cache {
+	pthread_mutex_t lock; // held between acquire and release
+	struct text_atlas *atlases[TEXT_ATLAS_CACHE_SIZE]; // most recent first
+};
+
+void text_atlas_cache_init(struct text_atlas_cache *cache);
+void text_atlas_cache_finish(struct text_atlas_cache *cache);
+
+/**
+ * Get the atlas for the face at a size in pixels, building it if needed.
+ * Returns NULL if it couldn't be built, which is remembered so that later
+ * calls for the same face and size fail right away. The cache is locked
+ * until text_atlas_release, even on failure.
+ */
+struct text_atlas *text_atlas_acquire(struct text_atlas_cache *cache,
+	cairo_font_face_t *face, double size);
+void text_atlas_release(struct text_atlas_cache *cache);
+
+void text_atlas_font_extents(const struct text_atlas *atlas,
+	cairo_font_extents_t *extents);
+/**
+ * Like cairo_text_extents. Returns false if the atlas is missing some of the
+ * characters.
+ */
+bool text_atlas_text_extents(const struct text_atlas *atlas, const char *text,
+	cairo_text_extents_t *extents);
+/**
+ * Draw text with its origin at x, y, rounded to whole pixels, using the
+ * current source. The transformation must map whole pixels to whole pixels,
+ * such as a rotation by a multiple of 90 degrees or a mirroring with integer
+ * translation, so that the atlas is never resampled. Returns false without
+ * drawing anything if the atlas is missing some of the characters.
+ */
+bool text_atlas_show_text(const struct text_atlas *atlas, cairo_t *cairo,
+	double x, double y, const char *text);
+
+#endif
@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xkbcommon/xkbcommon.h>
+#include "keymap-cache.h"
+#include "log.h"
+
+static uint64_t hash_keymap(const char *text, size_t size) {
+	// FNV-1a, only to skip most comparisons of the text
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= (unsigned char)text[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+struct xkb_keymap *keymap_cache_get(struct keymap_cache *cache,
+		struct xkb_context *context, const char *text, size_t size) {
+	uint64_t hash = hash_keymap(text, size);
+	struct keymap_cache_entry *lru = &cache->entries[0];
+	for (int i = 0; i < KEYMAP_CACHE_SIZE; ++i) {
+		struct keymap_cache_entry *entry = &cache->entries[i];
+		if (entry->keymap && entry->hash == hash && entry->size == size &&
+				memcmp(entry->text, text, size) == 0) {
+			entry->last_used = ++cache->uses;
+			swaylock_log(LOG_DEBUG, "Reusing compiled keymap %016llx",
+				(unsigned long long)hash);
+			return xkb_keymap_ref(entry->keymap);
+		}
+		if (!entry->keymap || (lru->keymap &&
+				entry->last_used < lru->last_used)) {
+			lru = entry;
+		}
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct xkb_keymap *keymap = xkb_keymap_new_from_buffer(context, text,
+		size, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!keymap) {
+		return NULL;
+	}
+	swaylock_log(LOG_DEBUG, "Compiled keymap %016llx (%zu bytes, %u layouts) "
+		"in %.1f ms", (unsigned long long)hash, size,
+		xkb_keymap_num_layouts(keymap),
+		(end.tv_sec - start.tv_sec) * 1e3 +
+		(end.tv_nsec - start.tv_nsec) / 1e6);
+
+	char *copy = malloc(size);
+	if (!copy) {
+		return keymap; // not cached
+	}
+	memcpy(copy, text, size);
+
+	xkb_keymap_unref(lru->keymap);
+	free(lru->text);
+	*lru = (struct keymap_cache_entry){
+		.hash = hash,
+		.size = size,
+		.text = copy,
+		.keymap = xkb_keymap_ref(keymap),
+		.last_used = ++cache->uses,
+	};
+	return keymap;
+}
@@ -23,6 +23,10 @@ void swaylock_log_init(enum log_importance verbosity) {
 	}
 }
 
+enum log_importance swaylock_log_get_verbosity(void) {
+	return log_importance;
+}
+
 void _swaylock_log(enum log_importance verbosity, const char *fmt, ...) {
 	if (verbosity > log_importance) {
 		return;
@@ -1,202 +1,853 @@
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <poll.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-client.h>
+#include "config.h"
 #include "log.h"
 #include "loop.h"
 
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
 struct loop_fd_event {
+	int fd;
+	short mask;
+	bool removed;
 	void (*callback)(int fd, short mask, void *data);
 	void *data;
+	const char *name; // NULL for the loop's own fds
 	struct wl_list link; // struct loop_fd_event::link
 };
 
-struct loop_timer {
-	void (*callback)(void *data);
+struct loop_signal {
+	int signo;
+	void (*callback)(int signo, void *data);
 	void *data;
-	struct timespec expiry;
-	bool removed;
-	struct wl_list link; // struct loop_timer::link
+	const char *name;
+	struct wl_list link; // struct loop_signal::link
+};
+
+struct loop_profile_entry {
+	const char *name;
+	uint64_t calls;
+	uint64_t total_ns, max_ns;
+	struct wl_list link; // struct loop_profile::entries
+};
+
+struct loop_profile {
+	uint64_t stall_ns;
+	struct wl_list entries; // struct loop_profile_entry::link
+	// Time from waking up until going back to sleep
+	struct loop_profile_entry iterations;
+	uint64_t woke_ns;
 };
 
 struct loop {
+	struct wl_list fd_events; // struct loop_fd_event::link
+	// Armed timers as a binary min-heap on expiry
+	struct loop_timer **timers;
+	size_t timers_length;
+	size_t timers_capacity;
+	struct wl_list signals; // struct loop_signal::link
+
+	// Removed fd events are only freed once dispatching is done
+	bool fd_events_removed;
+
+	struct loop_stats stats;
+	struct loop_profile *profile; // NULL unless profiling is enabled
+
+#if HAVE_EPOLL
+	int epoll_fd;
+	int timer_fd;
+	struct timespec timer_fd_expiry;
+	int signal_fd;
+	sigset_t signal_mask;
+#else
 	struct pollfd *fds;
+	struct loop_fd_event **fd_index;
 	int fd_length;
 	int fd_capacity;
-
-	struct wl_list fd_events; // struct loop_fd_event::link
-	struct wl_list timers; // struct loop_timer::link
+	bool fds_dirty;
+#endif
 };
 
-struct loop *loop_create(void) {
-	struct loop *loop = calloc(1, sizeof(struct loop));
-	if (!loop) {
-		swaylock_log(LOG_ERROR, "Unable to allocate memory for loop");
+static bool timespec_less(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void profile_add(struct loop_profile *profile,
+		struct loop_profile_entry *entry, uint64_t ns) {
+	++entry->calls;
+	entry->total_ns += ns;
+	if (ns > entry->max_ns) {
+		entry->max_ns = ns;
+	}
+	if (ns > profile->stall_ns) {
+		swaylock_log(LOG_INFO, "Event loop stalled: %s took %.2f ms",
+			entry->name, ns / 1e6);
+	}
+}
+
+static void profile_record(struct loop *loop, const char *name,
+		uint64_t start) {
+	uint64_t ns = get_time_ns() - start;
+	if (!name || !loop->profile) {
+		return;
+	}
+	struct loop_profile_entry *entry = NULL;
+	wl_list_for_each(entry, &loop->profile->entries, link) {
+		if (entry->name == name || strcmp(entry->name, name) == 0) {
+			profile_add(loop->profile, entry, ns);
+			return;
+		}
+	}
+	entry = calloc(1, sizeof(struct loop_profile_entry));
+	if (!entry) {
+		return;
+	}
+	entry->name = name;
+	wl_list_insert(loop->profile->entries.prev, &entry->link);
+	profile_add(loop->profile, entry, ns);
+}
+
+// Each of these costs a single branch while profiling is disabled
+
+static void call_fd_event(struct loop *loop, struct loop_fd_event *event,
+		short mask) {
+	if (loop->profile) {
+		uint64_t start = get_time_ns();
+		event->callback(event->fd, mask, event->data);
+		profile_record(loop, event->name, start);
+	} else {
+		event->callback(event->fd, mask, event->data);
+	}
+}
+
+static void call_timer(struct loop *loop, struct loop_timer *timer) {
+	if (loop->profile) {
+		uint64_t start = get_time_ns();
+		timer->callback(timer->data);
+		profile_record(loop, timer->name, start);
+	} else {
+		timer->callback(timer->data);
+	}
+}
+
+static void call_signal(struct loop *loop, struct loop_signal *handler,
+		int signo) {
+	if (loop->profile) {
+		uint64_t start = get_time_ns();
+		handler->callback(signo, handler->data);
+		profile_record(loop, handler->name, start);
+	} else {
+		handler->callback(signo, handler->data);
+	}
+}
+
+static void profile_wake(struct loop *loop) {
+	if (loop->profile) {
+		loop->profile->woke_ns = get_time_ns();
+	}
+}
+
+static void profile_sleep(struct loop *loop) {
+	if (loop->profile && loop->profile->woke_ns) {
+		profile_add(loop->profile, &loop->profile->iterations,
+			get_time_ns() - loop->profile->woke_ns);
+	}
+}
+
+static struct loop_fd_event *add_fd_event(struct loop *loop, int fd,
+		short mask, void (*callback)(int fd, short mask, void *data),
+		void *data, const char *name) {
+	struct loop_fd_event *event = calloc(1, sizeof(struct loop_fd_event));
+	if (!event) {
+		swaylock_log(LOG_ERROR, "Unable to allocate memory for event");
 		return NULL;
 	}
-	loop->fd_capacity = 10;
-	loop->fds = malloc(sizeof(struct pollfd) * loop->fd_capacity);
-	wl_list_init(&loop->fd_events);
-	wl_list_init(&loop->timers);
-	return loop;
+	event->fd = fd;
+	event->mask = mask;
+	event->callback = callback;
+	event->data = data;
+	event->name = name;
+	wl_list_insert(loop->fd_events.prev, &event->link);
+	return event;
 }
 
-void loop_destroy(struct loop *loop) {
+static void free_removed_fd_events(struct loop *loop) {
+	if (!loop->fd_events_removed) {
+		return;
+	}
 	struct loop_fd_event *event = NULL, *tmp_event = NULL;
 	wl_list_for_each_safe(event, tmp_event, &loop->fd_events, link) {
-		wl_list_remove(&event->link);
-		free(event);
+		if (event->removed) {
+			wl_list_remove(&event->link);
+			free(event);
+		}
+	}
+	loop->fd_events_removed = false;
+}
+
+static void dispatch_signal(struct loop *loop, int signo) {
+	struct loop_signal *handler = NULL, *tmp_handler = NULL;
+	wl_list_for_each_safe(handler, tmp_handler, &loop->signals, link) {
+		if (handler->signo == signo) {
+			call_signal(loop, handler, signo);
+		}
+	}
+}
+
+static void heap_set(struct loop *loop, size_t index,
+		struct loop_timer *timer) {
+	loop->timers[index] = timer;
+	timer->heap_index = index + 1;
+}
+
+static void heap_sift_up(struct loop *loop, size_t index) {
+	struct loop_timer *timer = loop->timers[index];
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+		if (!timespec_less(&timer->expiry, &loop->timers[parent]->expiry)) {
+			break;
+		}
+		heap_set(loop, index, loop->timers[parent]);
+		index = parent;
+	}
+	heap_set(loop, index, timer);
+}
+
+static void heap_sift_down(struct loop *loop, size_t index) {
+	struct loop_timer *timer = loop->timers[index];
+	while (true) {
+		size_t child = index * 2 + 1;
+		if (child >= loop->timers_length) {
+			break;
+		}
+		if (child + 1 < loop->timers_length &&
+				timespec_less(&loop->timers[child + 1]->expiry,
+					&loop->timers[child]->expiry)) {
+			++child;
+		}
+		if (!timespec_less(&loop->timers[child]->expiry, &timer->expiry)) {
+			break;
+		}
+		heap_set(loop, index, loop->timers[child]);
+		index = child;
+	}
+	heap_set(loop, index, timer);
+}
+
+static bool heap_insert(struct loop *loop, struct loop_timer *timer) {
+	if (loop->timers_length == loop->timers_capacity) {
+		// Only grows when more timers are armed at once than ever before
+		size_t capacity = loop->timers_capacity ?
+			loop->timers_capacity * 2 : 8;
+		struct loop_timer **timers = realloc(loop->timers,
+			sizeof(struct loop_timer *) * capacity);
+		if (!timers) {
+			swaylock_log(LOG_ERROR, "Unable to allocate memory for timer");
+			return false;
+		}
+		loop->timers = timers;
+		loop->timers_capacity = capacity;
+	}
+	heap_set(loop, loop->timers_length++, timer);
+	heap_sift_up(loop, loop->timers_length - 1);
+	return true;
+}
+
+static void heap_remove(struct loop *loop, struct loop_timer *timer) {
+	size_t index = timer->heap_index - 1;
+	timer->heap_index = 0;
+	struct loop_timer *last = loop->timers[--loop->timers_length];
+	if (last == timer) {
+		return;
+	}
+	heap_set(loop, index, last);
+	if (index > 0 && timespec_less(&last->expiry,
+			&loop->timers[(index - 1) / 2]->expiry)) {
+		heap_sift_up(loop, index);
+	} else {
+		heap_sift_down(loop, index);
+	}
+}
+
+static void dispatch_timers(struct loop *loop) {
+	if (loop->timers_length == 0) {
+		return;
+	}
+	bool fired = false;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	// Timers are disarmed before their callback runs, so callbacks are free
+	// to arm or disarm any timer, including their own
+	while (loop->timers_length > 0) {
+		struct loop_timer *timer = loop->timers[0];
+		if (timespec_less(&now, &timer->expiry)) {
+			break;
+		}
+		heap_remove(loop, timer);
+		fired = true;
+		++loop->stats.timers_fired;
+		call_timer(loop, timer);
+	}
+	if (fired) {
+		++loop->stats.timer_wakeups;
+	}
+}
+
+#if HAVE_EPOLL
+
+static void timer_in(int fd, short mask, void *data) {
+	uint64_t expirations;
+	(void)read(fd, &expirations, sizeof(expirations));
+}
+
+static void signal_in(int fd, short mask, void *data) {
+	struct loop *loop = data;
+	struct signalfd_siginfo si;
+	while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+		dispatch_signal(loop, si.ssi_signo);
+	}
+}
+
+static uint32_t poll_to_epoll(short mask) {
+	uint32_t events = 0;
+	if (mask & POLLIN) {
+		events |= EPOLLIN;
+	}
+	if (mask & POLLOUT) {
+		events |= EPOLLOUT;
+	}
+	return events;
+}
+
+static short epoll_to_poll(uint32_t events) {
+	short mask = 0;
+	if (events & EPOLLIN) {
+		mask |= POLLIN;
+	}
+	if (events & EPOLLOUT) {
+		mask |= POLLOUT;
+	}
+	if (events & EPOLLERR) {
+		mask |= POLLERR;
+	}
+	if (events & EPOLLHUP) {
+		mask |= POLLHUP;
+	}
+	return mask;
+}
+
+static bool backend_add_fd(struct loop *loop, struct loop_fd_event *event) {
+	struct epoll_event ev = {
+		.events = poll_to_epoll(event->mask),
+		.data.ptr = event,
+	};
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, event->fd, &ev) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to add fd %d to epoll",
+			event->fd);
+		return false;
+	}
+	return true;
+}
+
+static void backend_remove_fd(struct loop *loop, struct loop_fd_event *event) {
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, event->fd, NULL);
+}
+
+static bool backend_modify_fd(struct loop *loop, struct loop_fd_event *event) {
+	struct epoll_event ev = {
+		.events = poll_to_epoll(event->mask),
+		.data.ptr = event,
+	};
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, event->fd, &ev) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to modify fd %d in epoll",
+			event->fd);
+		return false;
+	}
+	return true;
+}
+
+static bool backend_init(struct loop *loop) {
+	loop->signal_fd = -1;
+	sigemptyset(&loop->signal_mask);
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to create epoll instance");
+		return false;
+	}
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+		TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop->timer_fd < 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to create timerfd");
+		close(loop->epoll_fd);
+		return false;
+	}
+	struct loop_fd_event *event =
+		add_fd_event(loop, loop->timer_fd, POLLIN, timer_in, loop, NULL);
+	if (!event || !backend_add_fd(loop, event)) {
+		if (event) {
+			wl_list_remove(&event->link);
+			free(event);
+		}
+		close(loop->timer_fd);
+		close(loop->epoll_fd);
+		return false;
+	}
+	return true;
+}
+
+static void backend_finish(struct loop *loop) {
+	if (loop->signal_fd >= 0) {
+		close(loop->signal_fd);
+		sigprocmask(SIG_UNBLOCK, &loop->signal_mask, NULL);
+	}
+	close(loop->timer_fd);
+	close(loop->epoll_fd);
+}
+
+static bool backend_add_signal(struct loop *loop, int signo) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, signo);
+	sigaddset(&loop->signal_mask, signo);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to block signal %d", signo);
+		return false;
+	}
+	bool created = loop->signal_fd < 0;
+	int fd = signalfd(loop->signal_fd, &loop->signal_mask,
+		SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to create signalfd");
+		return false;
+	}
+	loop->signal_fd = fd;
+	if (created) {
+		struct loop_fd_event *event =
+			add_fd_event(loop, fd, POLLIN, signal_in, loop, NULL);
+		if (!event || !backend_add_fd(loop, event)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Only touch the timerfd when the earliest expiry actually changes
+static void arm_timer_fd(struct loop *loop) {
+	struct itimerspec its = {0};
+	if (loop->timers_length > 0) {
+		its.it_value = loop->timers[0]->expiry;
+	}
+	if (its.it_value.tv_sec == loop->timer_fd_expiry.tv_sec &&
+			its.it_value.tv_nsec == loop->timer_fd_expiry.tv_nsec) {
+		return;
+	}
+	if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to arm timerfd");
+		return;
+	}
+	loop->timer_fd_expiry = its.it_value;
+}
+
+static int backend_poll(struct loop *loop) {
+	arm_timer_fd(loop);
+
+	struct epoll_event events[16];
+	profile_sleep(loop);
+	int ret = epoll_wait(loop->epoll_fd, events,
+		sizeof(events) / sizeof(events[0]), -1);
+	if (ret < 0 && errno != EINTR) {
+		swaylock_log_errno(LOG_ERROR, "epoll_wait failed");
+		exit(1);
 	}
-	struct loop_timer *timer = NULL, *tmp_timer = NULL;
-	wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
-		wl_list_remove(&timer->link);
-		free(timer);
+	profile_wake(loop);
+
+	for (int i = 0; i < ret; ++i) {
+		struct loop_fd_event *event = events[i].data.ptr;
+		if (event->removed) {
+			continue;
+		}
+		call_fd_event(loop, event, epoll_to_poll(events[i].events));
 	}
+	return ret;
+}
+
+#else
+
+static int signal_pipe[2] = {-1, -1};
+
+static void handle_signal(int signo) {
+	unsigned char byte = signo;
+	(void)write(signal_pipe[1], &byte, 1);
+}
+
+static void signal_in(int fd, short mask, void *data) {
+	struct loop *loop = data;
+	unsigned char signals[16];
+	ssize_t n;
+	while ((n = read(fd, signals, sizeof(signals))) > 0) {
+		for (ssize_t i = 0; i < n; ++i) {
+			dispatch_signal(loop, signals[i]);
+		}
+	}
+}
+
+static bool backend_add_fd(struct loop *loop, struct loop_fd_event *event) {
+	loop->fds_dirty = true;
+	return true;
+}
+
+static void backend_remove_fd(struct loop *loop, struct loop_fd_event *event) {
+	loop->fds_dirty = true;
+}
+
+static bool backend_modify_fd(struct loop *loop, struct loop_fd_event *event) {
+	loop->fds_dirty = true;
+	return true;
+}
+
+static bool backend_init(struct loop *loop) {
+	return true;
+}
+
+static void backend_finish(struct loop *loop) {
 	free(loop->fds);
-	free(loop);
+	free(loop->fd_index);
 }
 
-void loop_poll(struct loop *loop) {
-	// Calculate next timer in ms
-	int ms = INT_MAX;
-	if (!wl_list_empty(&loop->timers)) {
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		struct loop_timer *timer = NULL;
-		wl_list_for_each(timer, &loop->timers, link) {
-			int timer_ms = (timer->expiry.tv_sec - now.tv_sec) * 1000;
-			timer_ms += (timer->expiry.tv_nsec - now.tv_nsec) / 1000000;
-			if (timer_ms < ms) {
-				ms = timer_ms;
+static bool backend_add_signal(struct loop *loop, int signo) {
+	if (signal_pipe[0] < 0) {
+		if (pipe(signal_pipe) != 0) {
+			swaylock_log_errno(LOG_ERROR, "Failed to pipe");
+			return false;
+		}
+		for (int i = 0; i < 2; ++i) {
+			if (fcntl(signal_pipe[i], F_SETFL, O_NONBLOCK) == -1 ||
+					fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC) == -1) {
+				swaylock_log_errno(LOG_ERROR,
+					"Failed to make signal pipe nonblocking");
+				return false;
 			}
 		}
+		struct loop_fd_event *event =
+			add_fd_event(loop, signal_pipe[0], POLLIN, signal_in,
+			loop, NULL);
+		if (!event) {
+			return false;
+		}
+		backend_add_fd(loop, event);
+	}
+
+	struct sigaction sa;
+	sa.sa_handler = handle_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(signo, &sa, NULL) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to handle signal %d", signo);
+		return false;
+	}
+	return true;
+}
+
+static void rebuild_fds(struct loop *loop) {
+	int length = wl_list_length(&loop->fd_events);
+	if (length > loop->fd_capacity) {
+		loop->fd_capacity = length + 10;
+		loop->fds = realloc(loop->fds,
+			sizeof(struct pollfd) * loop->fd_capacity);
+		loop->fd_index = realloc(loop->fd_index,
+			sizeof(struct loop_fd_event *) * loop->fd_capacity);
+	}
+	loop->fd_length = 0;
+	struct loop_fd_event *event = NULL;
+	wl_list_for_each(event, &loop->fd_events, link) {
+		if (event->removed) {
+			continue;
+		}
+		loop->fds[loop->fd_length] =
+			(struct pollfd){ event->fd, event->mask, 0 };
+		loop->fd_index[loop->fd_length] = event;
+		++loop->fd_length;
+	}
+	loop->fds_dirty = false;
+}
+
+static int backend_poll(struct loop *loop) {
+	if (loop->fds_dirty) {
+		rebuild_fds(loop);
 	}
-	if (ms < 0) {
-		ms = 0;
+
+	int ms = -1;
+	if (loop->timers_length > 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		struct loop_timer *timer = loop->timers[0];
+		long long timer_ms = (timer->expiry.tv_sec - now.tv_sec) * 1000LL;
+		timer_ms += (timer->expiry.tv_nsec - now.tv_nsec + 999999) / 1000000;
+		ms = timer_ms < 0 ? 0 : timer_ms > INT_MAX ? INT_MAX : timer_ms;
 	}
 
+	profile_sleep(loop);
 	int ret = poll(loop->fds, loop->fd_length, ms);
 	if (ret < 0 && errno != EINTR) {
 		swaylock_log_errno(LOG_ERROR, "poll failed");
 		exit(1);
 	}
+	profile_wake(loop);
 
-	// Dispatch fds
-	size_t fd_index = 0;
-	struct loop_fd_event *event = NULL;
-	wl_list_for_each(event, &loop->fd_events, link) {
-		struct pollfd pfd = loop->fds[fd_index];
+	int pending = ret;
+	for (int i = 0; i < loop->fd_length && pending > 0; ++i) {
+		struct pollfd pfd = loop->fds[i];
+		struct loop_fd_event *event = loop->fd_index[i];
 
 		// Always send these events
 		unsigned events = pfd.events | POLLHUP | POLLERR;
 
 		if (pfd.revents & events) {
-			event->callback(pfd.fd, pfd.revents, event->data);
+			--pending;
+			if (!event->removed) {
+				call_fd_event(loop, event, pfd.revents);
+			}
 		}
-
-		++fd_index;
 	}
+	return ret;
+}
 
-	// Dispatch timers
-	if (!wl_list_empty(&loop->timers)) {
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		struct loop_timer *timer = NULL, *tmp_timer = NULL;
-		wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
-			if (timer->removed) {
-				wl_list_remove(&timer->link);
-				free(timer);
-				continue;
-			}
+#endif
 
-			bool expired = timer->expiry.tv_sec < now.tv_sec ||
-				(timer->expiry.tv_sec == now.tv_sec &&
-				 timer->expiry.tv_nsec < now.tv_nsec);
-			if (expired) {
-				timer->callback(timer->data);
-				wl_list_remove(&timer->link);
-				free(timer);
-			}
+struct loop *loop_create(void) {
+	struct loop *loop = calloc(1, sizeof(struct loop));
+	if (!loop) {
+		swaylock_log(LOG_ERROR, "Unable to allocate memory for loop");
+		return NULL;
+	}
+	wl_list_init(&loop->fd_events);
+	wl_list_init(&loop->signals);
+	if (!backend_init(loop)) {
+		free(loop);
+		return NULL;
+	}
+	return loop;
+}
+
+void loop_destroy(struct loop *loop) {
+	struct loop_fd_event *event = NULL, *tmp_event = NULL;
+	wl_list_for_each_safe(event, tmp_event, &loop->fd_events, link) {
+		wl_list_remove(&event->link);
+		free(event);
+	}
+	for (size_t i = 0; i < loop->timers_length; ++i) {
+		loop->timers[i]->heap_index = 0;
+	}
+	free(loop->timers);
+	struct loop_signal *handler = NULL, *tmp_handler = NULL;
+	wl_list_for_each_safe(handler, tmp_handler, &loop->signals, link) {
+		wl_list_remove(&handler->link);
+		free(handler);
+	}
+	if (loop->profile) {
+		struct loop_profile_entry *entry = NULL, *tmp_entry = NULL;
+		wl_list_for_each_safe(entry, tmp_entry, &loop->profile->entries,
+				link) {
+			wl_list_remove(&entry->link);
+			free(entry);
 		}
+		free(loop->profile);
 	}
+	backend_finish(loop);
+	free(loop);
 }
 
-void loop_add_fd(struct loop *loop, int fd, short mask,
-		void (*callback)(int fd, short mask, void *data), void *data) {
-	struct loop_fd_event *event = calloc(1, sizeof(struct loop_fd_event));
-	if (!event) {
-		swaylock_log(LOG_ERROR, "Unable to allocate memory for event");
-		return;
+void loop_poll(struct loop *loop) {
+	int ret = backend_poll(loop);
+	++loop->stats.wakeups;
+	if (ret > 0) {
+		loop->stats.fd_events += ret;
 	}
-	event->callback = callback;
-	event->data = data;
-	wl_list_insert(loop->fd_events.prev, &event->link);
+	free_removed_fd_events(loop);
+	dispatch_timers(loop);
+}
 
-	struct pollfd pfd = {fd, mask, 0};
+void loop_get_stats(struct loop *loop, struct loop_stats *stats) {
+	*stats = loop->stats;
+}
 
-	if (loop->fd_length == loop->fd_capacity) {
-		loop->fd_capacity += 10;
-		loop->fds = realloc(loop->fds,
-				sizeof(struct pollfd) * loop->fd_capacity);
+bool loop_enable_profiling(struct loop *loop, int stall_ms) {
+	if (loop->profile) {
+		loop->profile->stall_ns = (uint64_t)stall_ms * 1000000;
+		return true;
+	}
+	struct loop_profile *profile = calloc(1, sizeof(struct loop_profile));
+	if (!profile) {
+		swaylock_log(LOG_ERROR, "Unable to allocate memory for profile");
+		return false;
 	}
+	profile->stall_ns = (uint64_t)stall_ms * 1000000;
+	profile->iterations.name = "loop iteration";
+	wl_list_init(&profile->entries);
+	loop->profile = profile;
+	return true;
+}
 
-	loop->fds[loop->fd_length++] = pfd;
+static void log_profile_entry(struct loop_profile_entry *entry) {
+	swaylock_log(LOG_INFO, "%-24s %8llu %10.2f %10.1f %8.2f", entry->name,
+		(unsigned long long)entry->calls, entry->total_ns / 1e6,
+		entry->calls ? entry->total_ns / 1e3 / entry->calls : 0.0,
+		entry->max_ns / 1e6);
 }
 
-struct loop_timer *loop_add_timer(struct loop *loop, int ms,
-		void (*callback)(void *data), void *data) {
-	struct loop_timer *timer = calloc(1, sizeof(struct loop_timer));
-	if (!timer) {
-		swaylock_log(LOG_ERROR, "Unable to allocate memory for timer");
-		return NULL;
+void loop_log_profile(struct loop *loop) {
+	if (!loop->profile) {
+		return;
+	}
+	swaylock_log(LOG_INFO, "%-24s %8s %10s %10s %8s", "callback", "calls",
+		"total ms", "mean us", "max ms");
+	struct loop_profile_entry *entry = NULL;
+	wl_list_for_each(entry, &loop->profile->entries, link) {
+		log_profile_entry(entry);
 	}
+	log_profile_entry(&loop->profile->iterations);
+}
+
+void _loop_add_fd(struct loop *loop, int fd, short mask,
+		void (*callback)(int fd, short mask, void *data), void *data,
+		const char *name) {
+	struct loop_fd_event *event =
+		add_fd_event(loop, fd, mask, callback, data, name);
+	if (event && !backend_add_fd(loop, event)) {
+		wl_list_remove(&event->link);
+		free(event);
+	}
+}
+
+static void timespec_add_ms(struct timespec *ts, int ms) {
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+void _loop_timer_init(struct loop_timer *timer,
+		void (*callback)(void *data), void *data, const char *name) {
 	timer->callback = callback;
 	timer->data = data;
+	timer->name = name;
+	timer->slack_ms = 0;
+	timer->heap_index = 0;
+}
 
-	clock_gettime(CLOCK_MONOTONIC, &timer->expiry);
-	timer->expiry.tv_sec += ms / 1000;
+void loop_timer_set_slack(struct loop_timer *timer, int slack_ms) {
+	timer->slack_ms = slack_ms;
+}
 
-	long int nsec = (ms % 1000) * 1000000;
-	if (timer->expiry.tv_nsec + nsec >= 1000000000) {
-		timer->expiry.tv_sec++;
-		nsec -= 1000000000;
+static void timer_schedule(struct loop *loop, struct loop_timer *timer,
+		const struct timespec *_expiry) {
+	struct timespec expiry = *_expiry;
+	if (timer->slack_ms > 0) {
+		// Round up to a multiple of the slack, so that timers armed at
+		// different times end up sharing a wakeup
+		int64_t slack_ns = (int64_t)timer->slack_ms * 1000000;
+		int64_t ns = (int64_t)expiry.tv_sec * 1000000000 + expiry.tv_nsec;
+		ns = (ns + slack_ns - 1) / slack_ns * slack_ns;
+		expiry.tv_sec = ns / 1000000000;
+		expiry.tv_nsec = ns % 1000000000;
 	}
-	timer->expiry.tv_nsec += nsec;
 
-	wl_list_insert(&loop->timers, &timer->link);
+	if (timer->heap_index == 0) {
+		timer->expiry = expiry;
+		heap_insert(loop, timer);
+		return;
+	}
+	bool earlier = timespec_less(&expiry, &timer->expiry);
+	timer->expiry = expiry;
+	if (earlier) {
+		heap_sift_up(loop, timer->heap_index - 1);
+	} else {
+		heap_sift_down(loop, timer->heap_index - 1);
+	}
+}
 
-	return timer;
+void loop_timer_arm(struct loop *loop, struct loop_timer *timer, int ms) {
+	struct timespec expiry;
+	clock_gettime(CLOCK_MONOTONIC, &expiry);
+	timespec_add_ms(&expiry, ms);
+	timer_schedule(loop, timer, &expiry);
 }
 
-bool loop_remove_fd(struct loop *loop, int fd) {
-	size_t fd_index = 0;
-	struct loop_fd_event *event = NULL, *tmp_event = NULL;
-	wl_list_for_each_safe(event, tmp_event, &loop->fd_events, link) {
-		if (loop->fds[fd_index].fd == fd) {
-			wl_list_remove(&event->link);
-			free(event);
+void loop_timer_arm_at(struct loop *loop, struct loop_timer *timer,
+		const struct timespec *expiry) {
+	timer_schedule(loop, timer, expiry);
+}
 
-			loop->fd_length--;
-			memmove(&loop->fds[fd_index], &loop->fds[fd_index + 1],
-					sizeof(struct pollfd) * (loop->fd_length - fd_index));
-			return true;
+void loop_timer_disarm(struct loop *loop, struct loop_timer *timer) {
+	if (timer->heap_index != 0) {
+		heap_remove(loop, timer);
+	}
+}
+
+bool _loop_add_signal(struct loop *loop, int signo,
+		void (*callback)(int signo, void *data), void *data,
+		const char *name) {
+	struct loop_signal *handler = calloc(1, sizeof(struct loop_signal));
+	if (!handler) {
+		swaylock_log(LOG_ERROR, "Unable to allocate memory for signal");
+		return false;
+	}
+	handler->signo = signo;
+	handler->callback = callback;
+	handler->data = data;
+	handler->name = name;
+	if (!backend_add_signal(loop, signo)) {
+		free(handler);
+		return false;
+	}
+	wl_list_insert(loop->signals.prev, &handler->link);
+	return true;
+}
+
+bool loop_modify_fd(struct loop *loop, int fd, short mask) {
+	struct loop_fd_event *event = NULL;
+	wl_list_for_each(event, &loop->fd_events, link) {
+		if (event->fd == fd && !event->removed) {
+			event->mask = mask;
+			return backend_modify_fd(loop, event);
 		}
-		++fd_index;
 	}
 	return false;
 }
 
-bool loop_remove_timer(struct loop *loop, struct loop_timer *remove) {
-	struct loop_timer *timer = NULL, *tmp_timer = NULL;
-	wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
-		if (timer == remove) {
-			timer->removed = true;
+bool loop_remove_fd(struct loop *loop, int fd) {
+	struct loop_fd_event *event = NULL;
+	wl_list_for_each(event, &loop->fd_events, link) {
+		if (event->fd == fd && !event->removed) {
+			backend_remove_fd(loop, event);
+			// The event may still be pending in the current dispatch
+			event->removed = true;
+			loop->fd_events_removed = true;
 			return true;
 		}
 	}
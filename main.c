@@ -19,13 +19,19 @@
 #include "background-image.h"
 #include "cairo.h"
 #include "comm.h"
+#include "config.h"
 #include "log.h"
 #include "loop.h"
 #include "password-buffer.h"
 #include "pool-buffer.h"
+#include "render-thread.h"
 #include "seat.h"
 #include "swaylock.h"
 #include "ext-session-lock-v1-client-protocol.h"
+#if HAVE_FRACTIONAL_SCALE
+#include "fractional-scale-v1-client-protocol.h"
+#endif
+#include "viewporter-client-protocol.h"
 
 static uint32_t parse_color(const char *color) {
 	if (color[0] == '#') {
@@ -45,6 +51,20 @@ static uint32_t parse_color(const char *color) {
 	return res;
 }
 
+// Parses a duration in milliseconds, which must be a plain non-negative number
+static bool parse_ms(const char *str, uint32_t *ms) {
+	char *end;
+	errno = 0;
+	long long value = strtoll(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0' || value < 0 ||
+			value > UINT32_MAX) {
+		swaylock_log(LOG_ERROR, "Invalid duration: %s", str);
+		return false;
+	}
+	*ms = value;
+	return true;
+}
+
 int lenient_strcmp(char *a, char *b) {
 	if (a == b) {
 		return 0;
@@ -92,11 +112,30 @@ static void daemonize(void) {
 	}
 }
 
+static void present_render_jobs(struct swaylock_state *state);
+
 static void destroy_surface(struct swaylock_surface *surface) {
+	if (surface->render_pending) {
+		// The worker may still be drawing into the surface's buffers
+		surface->render_due = false;
+		render_thread_wait(surface->state->render_thread);
+		present_render_jobs(surface->state);
+	}
 	wl_list_remove(&surface->link);
 	if (surface->ext_session_lock_surface_v1 != NULL) {
 		ext_session_lock_surface_v1_destroy(surface->ext_session_lock_surface_v1);
 	}
+#if HAVE_FRACTIONAL_SCALE
+	if (surface->fractional_scale) {
+		wp_fractional_scale_v1_destroy(surface->fractional_scale);
+	}
+#endif
+	if (surface->viewport) {
+		wp_viewport_destroy(surface->viewport);
+	}
+	if (surface->child_viewport) {
+		wp_viewport_destroy(surface->child_viewport);
+	}
 	if (surface->subsurface) {
 		wl_subsurface_destroy(surface->subsurface);
 	}
@@ -117,13 +156,21 @@ static const struct ext_session_lock_surface_v1_listener ext_session_lock_surfac
 static cairo_surface_t *select_image(struct swaylock_state *state,
 		struct swaylock_surface *surface);
 
-static bool surface_is_opaque(struct swaylock_surface *surface) {
-	if (surface->image) {
-		return cairo_surface_get_content(surface->image) == CAIRO_CONTENT_COLOR;
+#if HAVE_FRACTIONAL_SCALE
+static void fractional_scale_handle_preferred_scale(void *data,
+		struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+	struct swaylock_surface *surface = data;
+	surface->preferred_scale = scale;
+	if (surface->state->run_display) {
+		damage_surface(surface);
 	}
-	return (surface->state->args.colors.background & 0xff) == 0xff;
 }
 
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+	.preferred_scale = fractional_scale_handle_preferred_scale,
+};
+#endif
+
 static void create_surface(struct swaylock_surface *surface) {
 	struct swaylock_state *state = surface->state;
 
@@ -138,14 +185,28 @@ static void create_surface(struct swaylock_surface *surface) {
 	assert(surface->subsurface);
 	wl_subsurface_set_sync(surface->subsurface);
 
+#if HAVE_FRACTIONAL_SCALE
+	// Buffers are sized for the exact scale and scaled down with viewports,
+	// rather than drawn for the next integer scale
+	if (state->viewporter && state->fractional_scale_manager) {
+		surface->viewport = wp_viewporter_get_viewport(state->viewporter,
+			surface->surface);
+		surface->child_viewport = wp_viewporter_get_viewport(
+			state->viewporter, surface->child);
+		surface->fractional_scale =
+			wp_fractional_scale_manager_v1_get_fractional_scale(
+				state->fractional_scale_manager, surface->surface);
+		wp_fractional_scale_v1_add_listener(surface->fractional_scale,
+			&fractional_scale_listener, surface);
+	}
+#endif
+
 	surface->ext_session_lock_surface_v1 = ext_session_lock_v1_get_lock_surface(
 		state->ext_session_lock_v1, surface->surface, surface->output);
 	ext_session_lock_surface_v1_add_listener(surface->ext_session_lock_surface_v1,
 		&ext_session_lock_surface_v1_listener, surface);
 
-	if (surface_is_opaque(surface) &&
-			surface->state->args.mode != BACKGROUND_MODE_CENTER &&
-			surface->state->args.mode != BACKGROUND_MODE_FIT) {
+	if (surface_is_opaque(surface)) {
 		struct wl_region *region =
 			wl_compositor_create_region(surface->state->compositor);
 		wl_region_add(region, 0, 0, INT32_MAX, INT32_MAX);
@@ -163,8 +224,17 @@ static void ext_session_lock_surface_v1_handle_configure(void *data,
 	surface->width = width;
 	surface->height = height;
 	ext_session_lock_surface_v1_ack_configure(lock_surface, serial);
-	render_frame_background(surface);
-	render_frame(surface);
+	if (surface->state->render_thread) {
+		// The background is redrawn along with the indicator. Each ack needs
+		// a commit, so the indicator is drawn even when nothing changed.
+		surface->last_snapshot_valid = false;
+		surface->dirty = true;
+		surface->render_due = true;
+	} else {
+		// Until the session is locked, render right away to lock sooner
+		render_frame_background(surface);
+		render_frame(surface);
+	}
 }
 
 static const struct ext_session_lock_surface_v1_listener ext_session_lock_surface_v1_listener = {
@@ -180,14 +250,10 @@ static void surface_frame_handle_done(void *data, struct wl_callback *callback,
 	wl_callback_destroy(callback);
 	surface->frame_pending = false;
 
+	// Rendering waits until all queued events have been dispatched, so a
+	// burst of key presses only results in a single frame
 	if (surface->dirty) {
-		// Schedule a frame in case the surface is damaged again
-		struct wl_callback *callback = wl_surface_frame(surface->surface);
-		wl_callback_add_listener(callback, &surface_frame_listener, surface);
-		surface->frame_pending = true;
-
-		render_frame(surface);
-		surface->dirty = false;
+		surface->render_due = true;
 	}
 }
 
@@ -202,7 +268,8 @@ void damage_surface(struct swaylock_surface *surface) {
 	}
 
 	surface->dirty = true;
-	if (surface->frame_pending) {
+	if (surface->frame_pending || surface->render_due ||
+			surface->render_pending) {
 		return;
 	}
 
@@ -219,12 +286,62 @@ void damage_state(struct swaylock_state *state) {
 	}
 }
 
+static void present_render_job(struct swaylock_render_job *job) {
+	struct swaylock_surface *surface = job->surface;
+
+	// Schedule a frame in case the surface is damaged again
+	struct wl_callback *callback = wl_surface_frame(surface->surface);
+	wl_callback_add_listener(callback, &surface_frame_listener, surface);
+	surface->frame_pending = true;
+
+	if (!render_job_present(job)) {
+		// Reconfigured in the meantime, draw again at the new size
+		surface->render_due = true;
+	}
+}
+
+void render_due_frames(struct swaylock_state *state) {
+	struct swaylock_surface *surface;
+	wl_list_for_each(surface, &state->surfaces, link) {
+		if (!surface->render_due || surface->render_pending) {
+			continue;
+		}
+		surface->render_due = false;
+		surface->dirty = false;
+
+		struct swaylock_render_job *job = &surface->render_job;
+		render_job_prepare(surface, job, true, true);
+		if (!job->background && !job->indicator) {
+			// Nothing to draw nor commit
+			++state->frames_skipped;
+			continue;
+		}
+		++state->frames_rendered;
+		if (state->render_thread &&
+				render_thread_submit(state->render_thread, job)) {
+			surface->render_pending = true;
+			continue;
+		}
+		render_job_run(state, job, state->test_cairo);
+		present_render_job(job);
+	}
+}
+
+static void present_render_jobs(struct swaylock_state *state) {
+	struct swaylock_render_job *job;
+	while ((job = render_thread_pop_done(state->render_thread))) {
+		job->surface->render_pending = false;
+		present_render_job(job);
+	}
+}
+
 static void handle_wl_output_geometry(void *data, struct wl_output *wl_output,
 		int32_t x, int32_t y, int32_t width_mm, int32_t height_mm,
 		int32_t subpixel, const char *make, const char *model,
 		int32_t transform) {
 	struct swaylock_surface *surface = data;
 	surface->subpixel = subpixel;
+	surface->transform = transform;
 	if (surface->state->run_display) {
 		damage_surface(surface);
 	}
@@ -287,6 +404,18 @@ static const struct ext_session_lock_v1_listener ext_session_lock_v1_listener =
 	.finished = ext_session_lock_v1_handle_finished,
 };
 
+static void shm_handle_format(void *data, struct wl_shm *shm,
+		uint32_t format) {
+	struct swaylock_state *state = data;
+	if (format == WL_SHM_FORMAT_RGB565) {
+		state->shm_rgb565 = true;
+	}
+}
+
+static const struct wl_shm_listener shm_listener = {
+	.format = shm_handle_format,
+};
+
 static void handle_global(void *data, struct wl_registry *registry,
 		uint32_t name, const char *interface, uint32_t version) {
 	struct swaylock_state *state = data;
@@ -299,6 +428,7 @@ static void handle_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
 		state->shm = wl_registry_bind(registry, name,
 				&wl_shm_interface, 1);
+		wl_shm_add_listener(state->shm, &shm_listener, state);
 	} else if (strcmp(interface, wl_seat_interface.name) == 0) {
 		struct wl_seat *seat = wl_registry_bind(
 				registry, name, &wl_seat_interface, 4);
@@ -318,6 +448,14 @@ static void handle_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(interface, ext_session_lock_manager_v1_interface.name) == 0) {
 		state->ext_session_lock_manager_v1 = wl_registry_bind(registry, name,
 				&ext_session_lock_manager_v1_interface, 1);
+	} else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+		state->viewporter = wl_registry_bind(registry, name,
+				&wp_viewporter_interface, 1);
+#if HAVE_FRACTIONAL_SCALE
+	} else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+		state->fractional_scale_manager = wl_registry_bind(registry, name,
+				&wp_fractional_scale_manager_v1_interface, 1);
+#endif
 	}
 }
 
@@ -338,12 +476,6 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = handle_global_remove,
 };
 
-static int sigusr_fds[2] = {-1, -1};
-
-void do_sigusr(int sig) {
-	(void)write(sigusr_fds[1], "1", 1);
-}
-
 static cairo_surface_t *select_image(struct swaylock_state *state,
 		struct swaylock_surface *surface) {
 	struct swaylock_image *image;
@@ -487,6 +619,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		LO_BS_HL_COLOR = 256,
 		LO_CAPS_LOCK_BS_HL_COLOR,
 		LO_CAPS_LOCK_KEY_HL_COLOR,
+		LO_FAIL_DELAY,
 		LO_FONT,
 		LO_FONT_SIZE,
 		LO_IND_IDLE_VISIBLE,
@@ -508,6 +641,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		LO_LINE_CAPS_LOCK_COLOR,
 		LO_LINE_VER_COLOR,
 		LO_LINE_WRONG_COLOR,
+		LO_LOW_MEMORY,
 		LO_RING_COLOR,
 		LO_RING_CLEAR_COLOR,
 		LO_RING_CAPS_LOCK_COLOR,
@@ -519,6 +653,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		LO_TEXT_CAPS_LOCK_COLOR,
 		LO_TEXT_VER_COLOR,
 		LO_TEXT_WRONG_COLOR,
+		LO_WARM_UP_AUTH,
 	};
 
 	static struct option long_options[] = {
@@ -544,6 +679,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		{"bs-hl-color", required_argument, NULL, LO_BS_HL_COLOR},
 		{"caps-lock-bs-hl-color", required_argument, NULL, LO_CAPS_LOCK_BS_HL_COLOR},
 		{"caps-lock-key-hl-color", required_argument, NULL, LO_CAPS_LOCK_KEY_HL_COLOR},
+		{"fail-delay", required_argument, NULL, LO_FAIL_DELAY},
 		{"font", required_argument, NULL, LO_FONT},
 		{"font-size", required_argument, NULL, LO_FONT_SIZE},
 		{"indicator-idle-visible", no_argument, NULL, LO_IND_IDLE_VISIBLE},
@@ -565,6 +701,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		{"line-caps-lock-color", required_argument, NULL, LO_LINE_CAPS_LOCK_COLOR},
 		{"line-ver-color", required_argument, NULL, LO_LINE_VER_COLOR},
 		{"line-wrong-color", required_argument, NULL, LO_LINE_WRONG_COLOR},
+		{"low-memory", no_argument, NULL, LO_LOW_MEMORY},
 		{"ring-color", required_argument, NULL, LO_RING_COLOR},
 		{"ring-clear-color", required_argument, NULL, LO_RING_CLEAR_COLOR},
 		{"ring-caps-lock-color", required_argument, NULL, LO_RING_CAPS_LOCK_COLOR},
@@ -576,6 +713,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		{"text-caps-lock-color", required_argument, NULL, LO_TEXT_CAPS_LOCK_COLOR},
 		{"text-ver-color", required_argument, NULL, LO_TEXT_VER_COLOR},
 		{"text-wrong-color", required_argument, NULL, LO_TEXT_WRONG_COLOR},
+		{"warm-up-auth", no_argument, NULL, LO_WARM_UP_AUTH},
 		{0, 0, 0, 0}
 	};
 
@@ -624,6 +762,8 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		"  --caps-lock-key-hl-color <color> "
 			"Sets the color of the key press highlight segments when "
 			"Caps Lock is active.\n"
+		"  --fail-delay <ms>                "
+			"Sets the delay before another attempt after a wrong password.\n"
 		"  --font <font>                    "
 			"Sets the font of the text.\n"
 		"  --font-size <size>               "
@@ -675,6 +815,8 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 			"Use the inside color for the line between the inside and ring.\n"
 		"  -r, --line-uses-ring             "
 			"Use the ring color for the line between the inside and ring.\n"
+		"  --low-memory                     "
+			"Use 16-bit buffers for opaque backgrounds.\n"
 		"  --ring-color <color>             "
 			"Sets the color of the ring of the indicator.\n"
 		"  --ring-clear-color <color>       "
@@ -698,6 +840,8 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 			"Sets the color of the text when verifying.\n"
 		"  --text-wrong-color <color>       "
 			"Sets the color of the text when invalid.\n"
+		"  --warm-up-auth                   "
+			"Prepare authentication at startup for a faster first attempt.\n"
 		"\n"
 		"All <color> options are of the form <rrggbb[aa]>.\n";
 
@@ -816,6 +960,11 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 				state->args.colors.caps_lock_key_highlight = parse_color(optarg);
 			}
 			break;
+		case LO_FAIL_DELAY:
+			if (state && !parse_ms(optarg, &state->args.fail_delay_ms)) {
+				return 1;
+			}
+			break;
 		case LO_FONT:
 			if (state) {
 				free(state->args.font);
@@ -924,6 +1073,11 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 				state->args.colors.line.wrong = parse_color(optarg);
 			}
 			break;
+		case LO_LOW_MEMORY:
+			if (state) {
+				state->args.low_memory = true;
+			}
+			break;
 		case LO_RING_COLOR:
 			if (state) {
 				state->args.colors.ring.input = parse_color(optarg);
@@ -979,6 +1133,11 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 				state->args.colors.text.wrong = parse_color(optarg);
 			}
 			break;
+		case LO_WARM_UP_AUTH:
+			if (state) {
+				state->args.warm_up_auth = true;
+			}
+			break;
 		default:
 			fprintf(stderr, "%s", usage);
 			return 1;
@@ -1066,25 +1225,105 @@ static int load_config(char *path, struct swaylock_state *state,
 
 static struct swaylock_state state;
 
+static bool display_readable = false;
+static short display_mask = POLLIN;
+
+static bool flush_display(void) {
+	errno = 0;
+	short mask = POLLIN;
+	if (wl_display_flush(state.display) == -1) {
+		if (errno != EAGAIN) {
+			swaylock_log_errno(LOG_ERROR, "wl_display_flush() failed");
+			return false;
+		}
+		// The socket is full, finish flushing once it has drained
+		mask |= POLLOUT;
+	}
+	if (mask != display_mask) {
+		loop_modify_fd(state.eventloop, wl_display_get_fd(state.display),
+			mask);
+		display_mask = mask;
+	}
+	return true;
+}
+
 static void display_in(int fd, short mask, void *data) {
-	if (wl_display_dispatch(state.display) == -1) {
-		state.run_display = false;
+	if (mask & POLLOUT) {
+		if (!flush_display()) {
+			state.run_display = false;
+		}
+	}
+	if (mask & (POLLIN | POLLHUP | POLLERR)) {
+		display_readable = true;
+	}
+}
+
+// Dispatch all queued events, render the frames that became due and flush
+// the resulting requests. On success, a read is prepared on the display.
+static bool dispatch_display(void) {
+	while (wl_display_prepare_read(state.display) != 0) {
+		if (wl_display_dispatch_pending(state.display) == -1) {
+			swaylock_log(LOG_ERROR, "wl_display_dispatch_pending() failed");
+			return false;
+		}
+	}
+	render_due_frames(&state);
+	if (!flush_display()) {
+		wl_display_cancel_read(state.display);
+		return false;
 	}
+	return true;
 }
 
 static void comm_in(int fd, short mask, void *data) {
-	if (read_comm_reply()) {
-		// Authentication succeeded
-		state.run_display = false;
-	} else {
+	struct comm_reply reply;
+	int ret;
+	while ((ret = read_comm_reply(&reply)) > 0) {
+		handle_auth_reply(&state, &reply);
+	}
+	if (ret < 0) {
+		// Nothing can be checked anymore, but stay locked
+		loop_remove_fd(state.eventloop, fd);
+		state.auth_request_id = 0;
 		state.auth_state = AUTH_STATE_INVALID;
 		schedule_auth_idle(&state);
-		++state.failed_attempts;
 		damage_state(&state);
 	}
 }
 
-static void term_in(int fd, short mask, void *data) {
+static void render_in(int fd, short mask, void *data) {
+	render_thread_ack(state.render_thread);
+	present_render_jobs(&state);
+	// Pick up surfaces damaged while their previous frame was being drawn
+	render_due_frames(&state);
+}
+
+static double timespec_diff_s(const struct timespec *start,
+		const struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) +
+		(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void log_loop_stats(const struct timespec *start,
+		const struct timespec *start_cpu) {
+	struct timespec now, now_cpu;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now_cpu);
+	double locked_s = timespec_diff_s(start, &now);
+	struct loop_stats stats;
+	loop_get_stats(state.eventloop, &stats);
+	swaylock_log(LOG_INFO, "Locked for %.1f s: %llu wakeups (%.2f/min, "
+		"%llu for timers), %.3f s CPU time", locked_s,
+		(unsigned long long)stats.wakeups,
+		locked_s > 0 ? stats.wakeups * 60 / locked_s : 0.0,
+		(unsigned long long)stats.timer_wakeups,
+		timespec_diff_s(start_cpu, &now_cpu));
+	swaylock_log(LOG_INFO, "Rendered %llu frames, skipped %llu which "
+		"wouldn't have changed", (unsigned long long)state.frames_rendered,
+		(unsigned long long)state.frames_skipped);
+}
+
+static void term_in(int signo, void *data) {
 	state.run_display = false;
 }
 
@@ -1140,6 +1379,7 @@ int main(int argc, char **argv) {
 		.show_failed_attempts = false,
 		.indicator_idle_visible = false,
 		.ready_fd = -1,
+		.fail_delay_ms = pw_backend_fail_delay_ms,
 	};
 	wl_list_init(&state.images);
 	set_default_colors(&state.args.colors);
@@ -1179,24 +1419,32 @@ int main(int argc, char **argv) {
 		state.args.colors.line = state.args.colors.ring;
 	}
 
+	if (state.args.show_indicator) {
+		// Resolved while the session is being locked
+		font_warm_up_start(&state.font, state.args.font);
+	}
+	text_atlas_cache_init(&state.text_atlases);
+
 	state.password.len = 0;
 	state.password.buffer_len = 1024;
 	state.password.buffer = password_buffer_create(state.password.buffer_len);
 	if (!state.password.buffer) {
 		return EXIT_FAILURE;
 	}
-
-	if (pipe(sigusr_fds) != 0) {
-		swaylock_log(LOG_ERROR, "Failed to pipe");
+	state.deferred_password.len = 0;
+	state.deferred_password.buffer_len = state.password.buffer_len;
+	state.deferred_password.buffer =
+		password_buffer_create(state.deferred_password.buffer_len);
+	if (!state.deferred_password.buffer) {
 		return EXIT_FAILURE;
 	}
-	if (fcntl(sigusr_fds[1], F_SETFL, O_NONBLOCK) == -1) {
-		swaylock_log(LOG_ERROR, "Failed to make pipe end nonblocking");
-		return EXIT_FAILURE;
+	if (state.args.warm_up_auth) {
+		// Done by the auth child while the session is being locked
+		write_comm_warm_up();
 	}
 
 	wl_list_init(&state.surfaces);
-	state.xkb.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 	state.display = wl_display_connect(NULL);
 	if (!state.display) {
 		free(state.args.font);
@@ -1206,6 +1454,14 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 	state.eventloop = loop_create();
+	if (!state.eventloop) {
+		return EXIT_FAILURE;
+	}
+	if (swaylock_log_get_verbosity() >= LOG_DEBUG) {
+		// Anything longer than half a frame at 60 Hz is noticeable
+		loop_enable_profiling(state.eventloop, 8);
+	}
+	initialize_password_timers(&state);
 
 	struct wl_registry *registry = wl_display_get_registry(state.display);
 	wl_registry_add_listener(registry, &registry_listener, &state);
@@ -1242,6 +1498,10 @@ int main(int argc, char **argv) {
 		free(state.args.font);
 		return 1;
 	}
+	if (state.args.low_memory && !state.shm_rgb565) {
+		swaylock_log(LOG_INFO, "The compositor doesn't support RGB565 "
+			"buffers, ignoring --low-memory");
+	}
 
 	state.test_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 1, 1);
 	state.test_cairo = cairo_create(state.test_surface);
@@ -1267,7 +1527,11 @@ int main(int argc, char **argv) {
 		state.args.ready_fd = -1;
 	}
 	if (state.args.daemonize) {
+		// Threads don't survive the fork
+		font_get_face(&state.font);
+		password_buffer_keep_on_fork(true);
 		daemonize();
+		password_buffer_keep_on_fork(false);
 	}
 
 	loop_add_fd(state.eventloop, wl_display_get_fd(state.display), POLLIN,
@@ -1275,26 +1539,55 @@ int main(int argc, char **argv) {
 
 	loop_add_fd(state.eventloop, get_comm_reply_fd(), POLLIN, comm_in, NULL);
 
-	loop_add_fd(state.eventloop, sigusr_fds[0], POLLIN, term_in, NULL);
+	if (!loop_add_signal(state.eventloop, SIGUSR1, term_in, NULL)) {
+		return EXIT_FAILURE;
+	}
+
+	// Once locked, frames are drawn off the Wayland thread
+	state.render_thread = render_thread_create(&state);
+	if (state.render_thread) {
+		loop_add_fd(state.eventloop, render_thread_get_fd(state.render_thread),
+			POLLIN, render_in, NULL);
+	} else {
+		swaylock_log(LOG_INFO, "Rendering on the main thread");
+	}
 
-	struct sigaction sa;
-	sa.sa_handler = do_sigusr;
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_RESTART;
-	sigaction(SIGUSR1, &sa, NULL);
+	struct timespec locked_start, locked_start_cpu;
+	clock_gettime(CLOCK_MONOTONIC, &locked_start);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &locked_start_cpu);
 
 	state.run_display = true;
 	while (state.run_display) {
-		errno = 0;
-		if (wl_display_flush(state.display) == -1 && errno != EAGAIN) {
+		if (!dispatch_display()) {
 			break;
 		}
 		loop_poll(state.eventloop);
+		// Events are only read here, the next dispatch_display() call
+		// handles all of them at once
+		if (display_readable) {
+			display_readable = false;
+			if (wl_display_read_events(state.display) == -1) {
+				swaylock_log(LOG_ERROR, "wl_display_read_events() failed");
+				break;
+			}
+		} else {
+			wl_display_cancel_read(state.display);
+		}
+	}
+	log_loop_stats(&locked_start, &locked_start_cpu);
+	loop_log_profile(state.eventloop);
+	if (state.render_thread) {
+		loop_remove_fd(state.eventloop,
+			render_thread_get_fd(state.render_thread));
+		render_thread_destroy(state.render_thread);
+		state.render_thread = NULL;
 	}
 
 	ext_session_lock_v1_unlock_and_destroy(state.ext_session_lock_v1);
 	wl_display_roundtrip(state.display);
 
+	text_atlas_cache_finish(&state.text_atlases);
+	font_finish(&state.font);
 	free(state.args.font);
 	cairo_destroy(state.test_cairo);
 	cairo_surface_destroy(state.test_surface);
@@ -1,13 +1,50 @@
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // for memfd_create, MAP_ANONYMOUS and madvise
 #include "password-buffer.h"
+#include "config.h"
 #include "log.h"
-#include "swaylock.h"
+#include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <limits.h>
 #include <sys/mman.h>
+#if HAVE_MEMFD_SECRET
+#include <sys/syscall.h>
+#endif
 
+/*
+ * Password buffers come from a small arena which is set up once per process:
+ * one page per slot, each surrounded by inaccessible guard pages, locked and
+ * excluded from core dumps. Taking and returning a slot doesn't need any
+ * syscall. Buffers which don't fit, or when the arena is exhausted, fall back
+ * to a separately locked allocation.
+ *
+ * When the kernel allows it the slots are backed by memfd_secret(), which
+ * also removes them from the kernel's direct map.
+ *
+ * Forked children get zeroed slots (or none at all for memfd_secret()), except
+ * for the fork which daemonizes swaylock: it keeps running in the child with
+ * its password buffers already taken, see password_buffer_keep_on_fork().
+ */
+#define PASSWORD_ARENA_SLOTS 8
+
+struct password_arena {
+	bool initialized;
+	bool failed;
+	bool secret;
+	char *base;
+	size_t size;
+	size_t slot_size; // page size, slots are slot_size apart from guards
+	int free_slots[PASSWORD_ARENA_SLOTS];
+	int free_count;
+	int relock_errno; // set in a forked child when mlock() failed
+};
+
+static struct password_arena arena = {0};
 static bool mlock_supported = true;
 static long int page_size = 0;
 
@@ -55,7 +92,163 @@ static bool password_buffer_unlock(char *addr, size_t size) {
 	return true;
 }
 
+static char *arena_slot(int slot) {
+	// Slot i sits between guard pages i and i + 1
+	return arena.base + (2 * slot + 1) * arena.slot_size;
+}
+
+#if HAVE_MEMFD_SECRET
+static bool arena_map_secret(void) {
+	int fd = syscall(SYS_memfd_secret, 0);
+	if (fd < 0) {
+		// Disabled by default on many kernels
+		swaylock_log_errno(LOG_DEBUG, "memfd_secret unavailable");
+		return false;
+	}
+	bool ok = ftruncate(fd, PASSWORD_ARENA_SLOTS * arena.slot_size) == 0;
+	for (int i = 0; ok && i < PASSWORD_ARENA_SLOTS; ++i) {
+		ok = mmap(arena_slot(i), arena.slot_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, i * arena.slot_size) != MAP_FAILED;
+	}
+	close(fd);
+	if (!ok) {
+		swaylock_log_errno(LOG_DEBUG, "Unable to map memfd_secret");
+		return false;
+	}
+	// Shared mappings can't be wiped on fork, keep them out of the child
+	madvise(arena.base, arena.size, MADV_DONTFORK);
+	return true;
+}
+#endif
+
+static bool arena_map_anonymous(void) {
+	for (int i = 0; i < PASSWORD_ARENA_SLOTS; ++i) {
+		char *slot = arena_slot(i);
+		if (mmap(slot, arena.slot_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+			swaylock_log_errno(LOG_ERROR, "Unable to map password memory");
+			return false;
+		}
+		if (!password_buffer_lock(slot, arena.slot_size)) {
+			return false;
+		}
+	}
+#ifdef MADV_WIPEONFORK
+	// A forked child gets zeroed pages rather than a copy of the passwords
+	if (madvise(arena.base, arena.size, MADV_WIPEONFORK) != 0) {
+		swaylock_log_errno(LOG_DEBUG, "MADV_WIPEONFORK unsupported");
+	}
+#endif
+	return true;
+}
+
+static void arena_relock(void) {
+	// Memory locks aren't inherited by a forked child, while the slots and
+	// the passwords in them are. memfd_secret() memory is always locked.
+	// Other threads may have held the stdio locks at fork time, so failures
+	// are only recorded here and logged by arena_report_relock().
+	if (!arena.base || arena.failed || arena.secret || !mlock_supported) {
+		return;
+	}
+	int saved_errno = errno;
+	for (int i = 0; i < PASSWORD_ARENA_SLOTS; ++i) {
+		if (mlock(arena_slot(i), arena.slot_size) != 0) {
+			arena.relock_errno = errno;
+		}
+	}
+	errno = saved_errno;
+}
+
+static void arena_report_relock(void) {
+	if (arena.relock_errno) {
+		errno = arena.relock_errno;
+		swaylock_log_errno(LOG_ERROR,
+			"Unable to mlock() password memory after fork.");
+		arena.relock_errno = 0;
+	}
+}
+
+static bool arena_init(void) {
+	arena.initialized = true;
+	arena.slot_size = get_page_size();
+	arena.size = (2 * PASSWORD_ARENA_SLOTS + 1) * arena.slot_size;
+
+	// Reserve the whole range inaccessible, then map the slots into it
+	arena.base = mmap(NULL, arena.size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arena.base == MAP_FAILED) {
+		swaylock_log_errno(LOG_ERROR, "Unable to reserve password memory");
+		arena.base = NULL;
+		return false;
+	}
+
+#if HAVE_MEMFD_SECRET
+	arena.secret = arena_map_secret();
+#endif
+	if (!arena.secret && !arena_map_anonymous()) {
+		return false;
+	}
+#ifdef MADV_DONTDUMP
+	madvise(arena.base, arena.size, MADV_DONTDUMP);
+#endif
+
+	static bool atfork_registered = false;
+	if (!atfork_registered) {
+		pthread_atfork(NULL, NULL, arena_relock);
+		atfork_registered = true;
+	}
+
+	for (int i = 0; i < PASSWORD_ARENA_SLOTS; ++i) {
+		arena.free_slots[i] = PASSWORD_ARENA_SLOTS - 1 - i;
+	}
+	arena.free_count = PASSWORD_ARENA_SLOTS;
+	swaylock_log(LOG_DEBUG, "Password arena: %d slots of %zu bytes%s",
+		PASSWORD_ARENA_SLOTS, arena.slot_size,
+		arena.secret ? ", memfd_secret" : "");
+	return true;
+}
+
+static char *arena_take(size_t size) {
+	arena_report_relock();
+	if (!arena.initialized && !arena_init()) {
+		if (arena.base) {
+			munmap(arena.base, arena.size);
+		}
+		arena = (struct password_arena){0};
+		arena.initialized = true;
+		arena.failed = true;
+	}
+	if (arena.failed || size > arena.slot_size || arena.free_count == 0) {
+		return NULL;
+	}
+	return arena_slot(arena.free_slots[--arena.free_count]);
+}
+
+static bool arena_give_back(char *buffer) {
+	if (!arena.base || arena.failed || buffer < arena.base ||
+			buffer >= arena.base + arena.size) {
+		return false;
+	}
+	int slot = ((buffer - arena.base) / arena.slot_size - 1) / 2;
+	arena.free_slots[arena.free_count++] = slot;
+	return true;
+}
+
+void clear_buffer(char *buf, size_t size) {
+	// Use volatile keyword so so compiler can't optimize this out.
+	volatile char *buffer = buf;
+	volatile char zero = '\0';
+	for (size_t i = 0; i < size; ++i) {
+		buffer[i] = zero;
+	}
+}
+
 char *password_buffer_create(size_t size) {
+	char *slot = arena_take(size);
+	if (slot) {
+		return slot;
+	}
+
 	void *buffer;
 	int result = posix_memalign(&buffer, get_page_size(), size);
 	if (result) {
@@ -75,6 +268,94 @@ char *password_buffer_create(size_t size) {
 
 void password_buffer_destroy(char *buffer, size_t size) {
 	clear_buffer(buffer, size);
+	if (arena_give_back(buffer)) {
+		return;
+	}
 	password_buffer_unlock(buffer, size);
 	free(buffer);
 }
+
+void password_buffer_keep_on_fork(bool keep) {
+	arena_report_relock();
+	if (!arena.base || arena.failed) {
+		return;
+	}
+#if HAVE_MEMFD_SECRET
+	if (arena.secret) {
+		madvise(arena.base, arena.size, keep ? MADV_DOFORK : MADV_DONTFORK);
+		return;
+	}
+#endif
+#ifdef MADV_WIPEONFORK
+	madvise(arena.base, arena.size, keep ? MADV_KEEPONFORK : MADV_WIPEONFORK);
+#endif
+}
+
+static int create_shared_fd(size_t size, bool *secret) {
+	int fd = -1;
+	*secret = false;
+#if HAVE_MEMFD_SECRET
+	fd = syscall(SYS_memfd_secret, O_CLOEXEC);
+	*secret = fd >= 0;
+#endif
+#if HAVE_MEMFD_CREATE
+	if (fd < 0) {
+		fd = memfd_create("swaylock-password", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	}
+#endif
+	if (fd < 0) {
+		return -1;
+	}
+	if (ftruncate(fd, size) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to size shared password memory");
+		close(fd);
+		return -1;
+	}
+#ifdef F_ADD_SEALS
+	// Nobody gets to shrink it under the other process' feet
+	if (!*secret) {
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+	}
+#endif
+	return fd;
+}
+
+static char *map_shared(int fd, size_t size) {
+	char *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buffer == MAP_FAILED) {
+		swaylock_log_errno(LOG_ERROR, "Unable to map shared password memory");
+		return NULL;
+	}
+#ifdef MADV_DONTDUMP
+	madvise(buffer, size, MADV_DONTDUMP);
+#endif
+	return buffer;
+}
+
+char *password_buffer_create_shared(size_t size, int *fd) {
+	bool secret;
+	*fd = create_shared_fd(size, &secret);
+	if (*fd < 0) {
+		return NULL;
+	}
+	char *buffer = map_shared(*fd, size);
+	// Locked pages stay resident for every process mapping them, so there's
+	// no need for the other side to lock them again. memfd_secret() memory
+	// is always locked.
+	if (buffer && !secret && !password_buffer_lock(buffer, size)) {
+		munmap(buffer, size);
+		buffer = NULL;
+	}
+	if (!buffer) {
+		close(*fd);
+		*fd = -1;
+		return NULL;
+	}
+	swaylock_log(LOG_DEBUG, "Shared password memory: %zu bytes%s", size,
+		secret ? ", memfd_secret" : "");
+	return buffer;
+}
+
+char *password_buffer_map_shared(int fd, size_t size) {
+	return map_shared(fd, size);
+}
@@ -1,26 +1,20 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <errno.h>
 #include <pwd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
 #include "comm.h"
 #include "log.h"
 #include "loop.h"
+#include "password-buffer.h"
 #include "seat.h"
 #include "swaylock.h"
 #include "unicode.h"
 
-void clear_buffer(char *buf, size_t size) {
-	// Use volatile keyword so so compiler can't optimize this out.
-	volatile char *buffer = buf;
-	volatile char zero = '\0';
-	for (size_t i = 0; i < size; ++i) {
-		buffer[i] = zero;
-	}
-}
-
 void clear_password_buffer(struct swaylock_password *pw) {
 	clear_buffer(pw->buffer, pw->buffer_len);
 	pw->len = 0;
@@ -48,44 +42,37 @@ static void append_ch(struct swaylock_password *pw, uint32_t codepoint) {
 
 static void set_input_idle(void *data) {
 	struct swaylock_state *state = data;
-	state->input_idle_timer = NULL;
 	state->input_state = INPUT_STATE_IDLE;
 	damage_state(state);
 }
 
 static void set_auth_idle(void *data) {
 	struct swaylock_state *state = data;
-	state->auth_idle_timer = NULL;
 	state->auth_state = AUTH_STATE_IDLE;
 	damage_state(state);
 }
 
 static void schedule_input_idle(struct swaylock_state *state) {
-	if (state->input_idle_timer) {
-		loop_remove_timer(state->eventloop, state->input_idle_timer);
-	}
-	state->input_idle_timer = loop_add_timer(
-		state->eventloop, 1500, set_input_idle, state);
+	loop_timer_arm(state->eventloop, &state->input_idle_timer, 1500);
 }
 
 static void cancel_input_idle(struct swaylock_state *state) {
-	if (state->input_idle_timer) {
-		loop_remove_timer(state->eventloop, state->input_idle_timer);
-		state->input_idle_timer = NULL;
-	}
+	loop_timer_disarm(state->eventloop, &state->input_idle_timer);
 }
 
 void schedule_auth_idle(struct swaylock_state *state) {
-	if (state->auth_idle_timer) {
-		loop_remove_timer(state->eventloop, state->auth_idle_timer);
-	}
-	state->auth_idle_timer = loop_add_timer(
-		state->eventloop, 3000, set_auth_idle, state);
+	loop_timer_arm(state->eventloop, &state->auth_idle_timer, 3000);
+}
+
+static void end_auth_backoff(void *data);
+
+static void show_verifying(void *data) {
+	struct swaylock_state *state = data;
+	damage_state(state);
 }
 
 static void clear_password(void *data) {
 	struct swaylock_state *state = data;
-	state->clear_password_timer = NULL;
 	state->input_state = INPUT_STATE_CLEAR;
 	schedule_input_idle(state);
 	clear_password_buffer(&state->password);
@@ -93,17 +80,51 @@ static void clear_password(void *data) {
 }
 
 static void schedule_password_clear(struct swaylock_state *state) {
-	if (state->clear_password_timer) {
-		loop_remove_timer(state->eventloop, state->clear_password_timer);
-	}
-	state->clear_password_timer = loop_add_timer(
-			state->eventloop, 10000, clear_password, state);
+	loop_timer_arm(state->eventloop, &state->clear_password_timer, 10000);
 }
 
 static void cancel_password_clear(struct swaylock_state *state) {
-	if (state->clear_password_timer) {
-		loop_remove_timer(state->eventloop, state->clear_password_timer);
-		state->clear_password_timer = NULL;
+	loop_timer_disarm(state->eventloop, &state->clear_password_timer);
+}
+
+void initialize_password_timers(struct swaylock_state *state) {
+	// None of these need to be exact, so let them share wakeups
+	loop_timer_init(&state->input_idle_timer, set_input_idle, state);
+	loop_timer_set_slack(&state->input_idle_timer, 250);
+	loop_timer_init(&state->auth_idle_timer, set_auth_idle, state);
+	loop_timer_set_slack(&state->auth_idle_timer, 250);
+	loop_timer_init(&state->clear_password_timer, clear_password, state);
+	loop_timer_set_slack(&state->clear_password_timer, 1000);
+	loop_timer_init(&state->auth_verifying_timer, show_verifying, state);
+	loop_timer_init(&state->auth_backoff_timer, end_auth_backoff, state);
+}
+
+// Grace period before showing AUTH_STATE_VALIDATING for checks expected to be
+// fast
+#define AUTH_VERIFYING_DELAY_MS 100
+
+static void send_password(struct swaylock_state *state,
+		struct swaylock_password *pw) {
+	state->auth_state = AUTH_STATE_VALIDATING;
+	loop_timer_disarm(state->eventloop, &state->auth_idle_timer);
+
+	uint32_t id = write_comm_request(pw);
+	if (!id) {
+		state->auth_state = AUTH_STATE_INVALID;
+		schedule_auth_idle(state);
+		damage_state(state);
+		return;
+	}
+	// Replies to earlier requests still in flight no longer affect the UI
+	state->auth_request_id = id;
+	clock_gettime(CLOCK_MONOTONIC, &state->auth_request_start);
+
+	// Don't flash "Verifying" if the last check was quicker than a glance
+	if (state->auth_latency_ms < AUTH_VERIFYING_DELAY_MS) {
+		loop_timer_arm(state->eventloop, &state->auth_verifying_timer,
+			AUTH_VERIFYING_DELAY_MS);
+	} else {
+		damage_state(state);
 	}
 }
 
@@ -113,16 +134,94 @@ static void submit_password(struct swaylock_state *state) {
 	}
 
 	state->input_state = INPUT_STATE_IDLE;
-	state->auth_state = AUTH_STATE_VALIDATING;
 	cancel_password_clear(state);
 	cancel_input_idle(state);
 
-	if (!write_comm_request(&state->password)) {
-		state->auth_state = AUTH_STATE_INVALID;
-		schedule_auth_idle(state);
+	if (state->auth_request_id != 0 ||
+			loop_timer_is_armed(&state->auth_backoff_timer)) {
+		// Checked once the back-off is over. Swap buffers, so that the
+		// next attempt can be typed in the meantime.
+		struct swaylock_password pw = state->deferred_password;
+		state->deferred_password = state->password;
+		state->password = pw;
+		clear_password_buffer(&state->password);
+		state->auth_deferred = true;
+		state->auth_state = AUTH_STATE_VALIDATING;
+		loop_timer_disarm(state->eventloop, &state->auth_idle_timer);
+		damage_state(state);
+		return;
+	}
+	send_password(state, &state->password);
+}
+
+static void end_auth_backoff(void *data) {
+	struct swaylock_state *state = data;
+	if (state->auth_deferred && state->auth_request_id == 0) {
+		state->auth_deferred = false;
+		send_password(state, &state->deferred_password);
+	}
+}
+
+// Upper bound for the back-off, unless the base delay is larger already
+#define AUTH_BACKOFF_MAX_MS 30000
+
+static uint32_t get_auth_backoff(struct swaylock_state *state) {
+	uint32_t base = state->args.fail_delay_ms;
+	if (base >= AUTH_BACKOFF_MAX_MS) {
+		return base;
+	}
+	// Doubled for each consecutive failure, which is all of them: a
+	// successful attempt unlocks
+	uint32_t delay = base;
+	for (int i = 1; i < state->failed_attempts &&
+			delay < AUTH_BACKOFF_MAX_MS; ++i) {
+		delay *= 2;
 	}
+	return delay < AUTH_BACKOFF_MAX_MS ? delay : AUTH_BACKOFF_MAX_MS;
+}
 
+void handle_auth_reply(struct swaylock_state *state,
+		const struct comm_reply *reply) {
+	bool current = reply->id == state->auth_request_id;
+	if (current) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t ms = (now.tv_sec - state->auth_request_start.tv_sec) * 1000 +
+			(now.tv_nsec - state->auth_request_start.tv_nsec) / 1000000;
+		state->auth_latency_ms = ms > 0 ? ms : 0;
+		state->auth_request_id = 0;
+		loop_timer_disarm(state->eventloop, &state->auth_verifying_timer);
+	}
+	swaylock_log(LOG_DEBUG, "Password check %u %s: %.1f ms in the backend "
+		"(status %d), %u ms round trip", reply->id,
+		reply->success ? "succeeded" : "failed",
+		reply->duration_ns / 1e6, reply->status,
+		current ? state->auth_latency_ms : 0);
+
+	if (reply->success) {
+		state->run_display = false;
+		return;
+	}
+
+	++state->failed_attempts;
+	if (!current) {
+		// A later attempt is still being checked
+		damage_state(state);
+		return;
+	}
+	state->auth_state = AUTH_STATE_INVALID;
+	schedule_auth_idle(state);
 	damage_state(state);
+
+	// Slow down guessing. Further attempts are held back here rather than
+	// in the auth child, so it's free to answer as soon as they're sent.
+	uint32_t backoff = get_auth_backoff(state);
+	swaylock_log(LOG_DEBUG, "Next password check in %u ms", backoff);
+	if (backoff > 0) {
+		loop_timer_arm(state->eventloop, &state->auth_backoff_timer, backoff);
+	} else {
+		end_auth_backoff(state);
+	}
 }
 
 static void update_highlight(struct swaylock_state *state) {
@@ -132,7 +231,7 @@ static void update_highlight(struct swaylock_state *state) {
 }
 
 void swaylock_handle_key(struct swaylock_state *state,
-		xkb_keysym_t keysym, uint32_t codepoint) {
+		const struct swaylock_xkb *xkb, xkb_keysym_t keysym, uint32_t codepoint) {
 
 	switch (keysym) {
 	case XKB_KEY_KP_Enter: /* fallthrough */
@@ -141,7 +240,7 @@ void swaylock_handle_key(struct swaylock_state *state,
 		break;
 	case XKB_KEY_Delete:
 	case XKB_KEY_BackSpace:
-		if (state->xkb.control) {
+		if (xkb->control) {
 			clear_password_buffer(&state->password);
 			state->input_state = INPUT_STATE_CLEAR;
 			cancel_password_clear(state);
@@ -184,14 +283,14 @@ void swaylock_handle_key(struct swaylock_state *state,
 	case XKB_KEY_m: /* fallthrough */
 	case XKB_KEY_d:
 	case XKB_KEY_j:
-		if (state->xkb.control) {
+		if (xkb->control) {
 			submit_password(state);
 			break;
 		}
 		// fallthrough
 	case XKB_KEY_c: /* fallthrough */
 	case XKB_KEY_u:
-		if (state->xkb.control) {
+		if (xkb->control) {
 			clear_password_buffer(&state->password);
 			state->input_state = INPUT_STATE_CLEAR;
 			cancel_password_clear(state);
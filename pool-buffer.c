@@ -46,38 +46,114 @@ static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_release
 };
 
-struct pool_buffer *create_buffer(struct wl_shm *shm,
-		struct pool_buffer *buf, int32_t width, int32_t height,
+static void release_memory(struct pool_buffer *buffer) {
+	if (buffer->has_fd) {
+		close(buffer->fd);
+		buffer->has_fd = false;
+	}
+	if (buffer->cairo) {
+		cairo_destroy(buffer->cairo);
+	}
+	if (buffer->surface) {
+		cairo_surface_destroy(buffer->surface);
+	}
+	if (buffer->data) {
+		munmap(buffer->data, buffer->size);
+	}
+	buffer->cairo = NULL;
+	buffer->surface = NULL;
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->width = buffer->height = 0;
+}
+
+static cairo_format_t get_cairo_format(uint32_t format) {
+	// Both describe pixels in native endianness
+	switch (format) {
+	case WL_SHM_FORMAT_XRGB8888:
+		return CAIRO_FORMAT_RGB24;
+	case WL_SHM_FORMAT_RGB565:
+		return CAIRO_FORMAT_RGB16_565;
+	default:
+		return CAIRO_FORMAT_ARGB32;
+	}
+}
+
+bool alloc_buffer(struct pool_buffer *buf, int32_t width, int32_t height,
 		uint32_t format) {
-	uint32_t stride = width * 4;
-	size_t size = stride * height;
+	if (buf->data) {
+		if (buf->width == (uint32_t)width && buf->height == (uint32_t)height &&
+				buf->format == format) {
+			return true;
+		}
+		// The old wl_buffer is destroyed when the new one is exported
+		release_memory(buf);
+		if (buf->buffer) {
+			buf->stale_buffer = buf->buffer;
+			buf->buffer = NULL;
+		}
+	}
+
+	cairo_format_t cairo_format = get_cairo_format(format);
+	uint32_t stride = cairo_format_stride_for_width(cairo_format, width);
+	size_t size = (size_t)stride * height;
 
 	void *data = NULL;
 	if (size > 0) {
 		int fd = anonymous_shm_open();
 		if (fd == -1) {
-			return NULL;
+			return false;
 		}
 		if (ftruncate(fd, size) < 0) {
 			close(fd);
-			return NULL;
+			return false;
 		}
 		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-		struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-		buf->buffer = wl_shm_pool_create_buffer(pool, 0,
-				width, height, stride, format);
-		wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
-		wl_shm_pool_destroy(pool);
-		close(fd);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		buf->fd = fd;
+		buf->has_fd = true;
 	}
 
 	buf->size = size;
 	buf->width = width;
 	buf->height = height;
+	buf->stride = stride;
+	buf->format = format;
 	buf->data = data;
 	buf->surface = cairo_image_surface_create_for_data(data,
-			CAIRO_FORMAT_ARGB32, width, height, stride);
+			cairo_format, width, height, stride);
 	buf->cairo = cairo_create(buf->surface);
+	return true;
+}
+
+bool export_buffer(struct wl_shm *shm, struct pool_buffer *buf) {
+	if (buf->stale_buffer) {
+		wl_buffer_destroy(buf->stale_buffer);
+		buf->stale_buffer = NULL;
+	}
+	if (buf->buffer || buf->size == 0) {
+		return true;
+	}
+	struct wl_shm_pool *pool = wl_shm_create_pool(shm, buf->fd, buf->size);
+	buf->buffer = wl_shm_pool_create_buffer(pool, 0,
+			buf->width, buf->height, buf->stride, buf->format);
+	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
+	wl_shm_pool_destroy(pool);
+	close(buf->fd);
+	buf->has_fd = false;
+	return buf->buffer != NULL;
+}
+
+struct pool_buffer *create_buffer(struct wl_shm *shm,
+		struct pool_buffer *buf, int32_t width, int32_t height,
+		uint32_t format) {
+	if (!alloc_buffer(buf, width, height, format) ||
+			!export_buffer(shm, buf)) {
+		return NULL;
+	}
 	return buf;
 }
 
@@ -85,43 +161,20 @@ void destroy_buffer(struct pool_buffer *buffer) {
 	if (buffer->buffer) {
 		wl_buffer_destroy(buffer->buffer);
 	}
-	if (buffer->cairo) {
-		cairo_destroy(buffer->cairo);
-	}
-	if (buffer->surface) {
-		cairo_surface_destroy(buffer->surface);
-	}
-	if (buffer->data) {
-		munmap(buffer->data, buffer->size);
+	if (buffer->stale_buffer) {
+		wl_buffer_destroy(buffer->stale_buffer);
 	}
+	release_memory(buffer);
 	memset(buffer, 0, sizeof(struct pool_buffer));
 }
 
-struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], uint32_t width, uint32_t height) {
+struct pool_buffer *get_free_buffer(struct pool_buffer pool[static 2]) {
 	struct pool_buffer *buffer = NULL;
-
 	for (size_t i = 0; i < 2; ++i) {
-		if (pool[i].busy) {
-			continue;
+		if (!pool[i].busy) {
+			buffer = &pool[i];
 		}
-		buffer = &pool[i];
-	}
-
-	if (!buffer) {
-		return NULL;
 	}
-
-	if (buffer->width != width || buffer->height != height) {
-		destroy_buffer(buffer);
-	}
-
-	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height,
-					WL_SHM_FORMAT_ARGB8888)) {
-			return NULL;
-		}
-	}
-	buffer->busy = true;
 	return buffer;
 }
+
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "log.h"
+#include "render-thread.h"
+#include "swaylock.h"
+
+// Each surface has at most one job in flight, so this is never reached
+// with a sane number of outputs
+#define JOB_RING_SIZE 256
+
+struct job_ring {
+	atomic_size_t head; // written by the consumer
+	atomic_size_t tail; // written by the producer
+	struct swaylock_render_job *jobs[JOB_RING_SIZE];
+};
+
+struct render_thread {
+	struct swaylock_state *state;
+	pthread_t thread;
+	sem_t wake;
+	atomic_bool quit;
+	atomic_int pending; // submitted jobs the worker isn't done with
+
+	struct job_ring todo; // Wayland thread -> worker
+	struct job_ring done; // worker -> Wayland thread
+	int done_pipe[2];
+
+	// Only used by the worker, cairo contexts can't be shared
+	cairo_surface_t *test_surface;
+	cairo_t *test_cairo;
+};
+
+static bool ring_push(struct job_ring *ring, struct swaylock_render_job *job) {
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (tail - head == JOB_RING_SIZE) {
+		return false;
+	}
+	ring->jobs[tail % JOB_RING_SIZE] = job;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+static struct swaylock_render_job *ring_pop(struct job_ring *ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head == tail) {
+		return NULL;
+	}
+	struct swaylock_render_job *job = ring->jobs[head % JOB_RING_SIZE];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return job;
+}
+
+static void *render_thread_run(void *data) {
+	struct render_thread *rt = data;
+	while (true) {
+		if (sem_wait(&rt->wake) != 0) {
+			continue; // EINTR
+		}
+		if (atomic_load(&rt->quit)) {
+			break;
+		}
+		struct swaylock_render_job *job = ring_pop(&rt->todo);
+		if (!job) {
+			continue;
+		}
+
+		render_job_run(rt->state, job, rt->test_cairo);
+
+		// Can't fail, the done ring is as large as the todo ring
+		ring_push(&rt->done, job);
+		atomic_fetch_sub(&rt->pending, 1);
+		char byte = 0;
+		// If the pipe is full, it's readable already
+		(void)write(rt->done_pipe[1], &byte, 1);
+	}
+	return NULL;
+}
+
+struct render_thread *render_thread_create(struct swaylock_state *state) {
+	struct render_thread *rt = calloc(1, sizeof(*rt));
+	if (!rt) {
+		swaylock_log(LOG_ERROR, "Unable to allocate render thread");
+		return NULL;
+	}
+	rt->state = state;
+	atomic_init(&rt->todo.head, 0);
+	atomic_init(&rt->todo.tail, 0);
+	atomic_init(&rt->done.head, 0);
+	atomic_init(&rt->done.tail, 0);
+	atomic_init(&rt->quit, false);
+	atomic_init(&rt->pending, 0);
+
+	if (pipe(rt->done_pipe) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Failed to pipe");
+		free(rt);
+		return NULL;
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (fcntl(rt->done_pipe[i], F_SETFL, O_NONBLOCK) == -1 ||
+				fcntl(rt->done_pipe[i], F_SETFD, FD_CLOEXEC) == -1) {
+			swaylock_log_errno(LOG_ERROR,
+				"Failed to make render pipe nonblocking");
+			goto error_pipe;
+		}
+	}
+
+	if (sem_init(&rt->wake, 0, 0) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Failed to create semaphore");
+		goto error_pipe;
+	}
+
+	rt->test_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 1, 1);
+	rt->test_cairo = cairo_create(rt->test_surface);
+
+	// Signals are handled by the event loop on the Wayland thread
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int err = pthread_create(&rt->thread, NULL, render_thread_run, rt);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err != 0) {
+		errno = err;
+		swaylock_log_errno(LOG_ERROR, "Failed to start render thread");
+		goto error_thread;
+	}
+	return rt;
+
+error_thread:
+	cairo_destroy(rt->test_cairo);
+	cairo_surface_destroy(rt->test_surface);
+	sem_destroy(&rt->wake);
+error_pipe:
+	close(rt->done_pipe[0]);
+	close(rt->done_pipe[1]);
+	free(rt);
+	return NULL;
+}
+
+void render_thread_destroy(struct render_thread *rt) {
+	if (!rt) {
+		return;
+	}
+	atomic_store(&rt->quit, true);
+	sem_post(&rt->wake);
+	pthread_join(rt->thread, NULL);
+
+	cairo_destroy(rt->test_cairo);
+	cairo_surface_destroy(rt->test_surface);
+	sem_destroy(&rt->wake);
+	close(rt->done_pipe[0]);
+	close(rt->done_pipe[1]);
+	free(rt);
+}
+
+bool render_thread_submit(struct render_thread *rt,
+		struct swaylock_render_job *job) {
+	atomic_fetch_add(&rt->pending, 1);
+	if (!ring_push(&rt->todo, job)) {
+		atomic_fetch_sub(&rt->pending, 1);
+		return false;
+	}
+	sem_post(&rt->wake);
+	return true;
+}
+
+struct swaylock_render_job *render_thread_pop_done(struct render_thread *rt) {
+	return ring_pop(&rt->done);
+}
+
+int render_thread_get_fd(struct render_thread *rt) {
+	return rt->done_pipe[0];
+}
+
+void render_thread_ack(struct render_thread *rt) {
+	char buf[64];
+	while (read(rt->done_pipe[0], buf, sizeof(buf)) > 0) {
+		// Drain
+	}
+}
+
+void render_thread_wait(struct render_thread *rt) {
+	while (atomic_load(&rt->pending) > 0) {
+		struct pollfd pfd = { .fd = rt->done_pipe[0], .events = POLLIN };
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			swaylock_log_errno(LOG_ERROR, "poll failed");
+			return;
+		}
+		render_thread_ack(rt);
+	}
+}
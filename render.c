@@ -1,84 +1,322 @@
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-client.h>
 #include "cairo.h"
 #include "background-image.h"
 #include "swaylock.h"
 #include "log.h"
+#include "ring-raster.h"
+#include "text-atlas.h"
+#include "viewporter-client-protocol.h"
 
 #define M_PI 3.14159265358979323846
 const float TYPE_INDICATOR_RANGE = M_PI / 3.0f;
 const float TYPE_INDICATOR_BORDER_THICKNESS = M_PI / 128.0f;
 
-static void set_color_for_state(cairo_t *cairo, struct swaylock_state *state,
+static uint32_t get_color_for_state(struct swaylock_state *state,
+		const struct swaylock_render_snapshot *snapshot,
 		struct swaylock_colorset *colorset) {
-	if (state->input_state == INPUT_STATE_CLEAR) {
-		cairo_set_source_u32(cairo, colorset->cleared);
-	} else if (state->auth_state == AUTH_STATE_VALIDATING) {
-		cairo_set_source_u32(cairo, colorset->verifying);
-	} else if (state->auth_state == AUTH_STATE_INVALID) {
-		cairo_set_source_u32(cairo, colorset->wrong);
+	if (snapshot->input_state == INPUT_STATE_CLEAR) {
+		return colorset->cleared;
+	} else if (snapshot->auth_state == AUTH_STATE_VALIDATING) {
+		return colorset->verifying;
+	} else if (snapshot->auth_state == AUTH_STATE_INVALID) {
+		return colorset->wrong;
 	} else {
-		if (state->xkb.caps_lock && state->args.show_caps_lock_indicator) {
-			cairo_set_source_u32(cairo, colorset->caps_lock);
-		} else if (state->xkb.caps_lock && !state->args.show_caps_lock_indicator &&
-				state->args.show_caps_lock_text) {
-			uint32_t inputtextcolor = state->args.colors.text.input;
-			state->args.colors.text.input = state->args.colors.text.caps_lock;
-			cairo_set_source_u32(cairo, colorset->input);
-			state->args.colors.text.input = inputtextcolor;
+		if (snapshot->caps_lock && state->args.show_caps_lock_indicator) {
+			return colorset->caps_lock;
+		} else if (snapshot->caps_lock && !state->args.show_caps_lock_indicator &&
+				state->args.show_caps_lock_text &&
+				colorset == &state->args.colors.text) {
+			return state->args.colors.text.caps_lock;
 		} else {
-			cairo_set_source_u32(cairo, colorset->input);
+			return colorset->input;
 		}
 	}
 }
 
-void render_frame_background(struct swaylock_surface *surface) {
+static void set_color_for_state(cairo_t *cairo, struct swaylock_state *state,
+		const struct swaylock_render_snapshot *snapshot,
+		struct swaylock_colorset *colorset) {
+	cairo_set_source_u32(cairo,
+		get_color_for_state(state, snapshot, colorset));
+}
+
+// Fractional scales need viewports to give the surface its size
+static bool uses_viewport(struct swaylock_surface *surface) {
+	return surface->viewport && surface->preferred_scale;
+}
+
+static double get_surface_scale(struct swaylock_surface *surface) {
+	if (uses_viewport(surface)) {
+		return surface->preferred_scale / 120.0;
+	}
+	return surface->scale;
+}
+
+// Size in buffer pixels of a length in surface pixels, rounded the way the
+// fractional scale protocol wants
+static int scale_length(int length, double scale) {
+	return round(length * scale);
+}
+
+static void take_render_snapshot(struct swaylock_surface *surface,
+		struct swaylock_render_snapshot *snapshot) {
 	struct swaylock_state *state = surface->state;
+	*snapshot = (struct swaylock_render_snapshot){
+		.width = surface->width,
+		.height = surface->height,
+		.scale = get_surface_scale(surface),
+		.viewport = uses_viewport(surface),
+		.subpixel = surface->subpixel,
+		.transform = surface->transform,
+		.show_indicator = state->args.show_indicator &&
+			(state->auth_state != AUTH_STATE_IDLE ||
+				state->input_state != INPUT_STATE_IDLE ||
+				state->args.indicator_idle_visible),
+	};
+	if (!snapshot->show_indicator) {
+		return;
+	}
 
-	int buffer_width = surface->width * surface->scale;
-	int buffer_height = surface->height * surface->scale;
-	if (buffer_width == 0 || buffer_height == 0) {
-		return; // not yet configured
+	// Only what makes a visible difference is kept, so that frames which
+	// would look the same can be recognized
+	snapshot->auth_state = state->auth_state;
+	snapshot->input_state = state->input_state;
+	if (snapshot->input_state == INPUT_STATE_NEUTRAL) {
+		snapshot->input_state = INPUT_STATE_IDLE;
+	}
+	if (snapshot->input_state == INPUT_STATE_LETTER ||
+			snapshot->input_state == INPUT_STATE_BACKSPACE) {
+		snapshot->highlight_start = state->highlight_start;
+	}
+	if (state->args.show_failed_attempts) {
+		snapshot->failed_attempts = state->failed_attempts > 1000 ?
+			1000 : state->failed_attempts;
+	}
+	if (state->args.show_caps_lock_indicator ||
+			state->args.show_caps_lock_text) {
+		snapshot->caps_lock = state->xkb && state->xkb->caps_lock;
 	}
 
-	wl_surface_set_buffer_scale(surface->surface, surface->scale);
+	// The layout is only shown alongside the indicator
+	if (state->input_state == INPUT_STATE_CLEAR ||
+			state->auth_state == AUTH_STATE_VALIDATING ||
+			state->auth_state == AUTH_STATE_INVALID ||
+			!state->xkb || !state->xkb->keymap) {
+		return;
+	}
 
-	if (buffer_width != surface->last_buffer_width ||
-			buffer_height != surface->last_buffer_height) {
-		struct pool_buffer buffer;
-		if (!create_buffer(state->shm, &buffer, buffer_width, buffer_height,
-				WL_SHM_FORMAT_ARGB8888)) {
-			swaylock_log(LOG_ERROR,
-				"Failed to create new buffer for frame background.");
-			return;
-		}
+	xkb_layout_index_t num_layout = xkb_keymap_num_layouts(state->xkb->keymap);
+	if (!state->args.hide_keyboard_layout &&
+			(state->args.show_keyboard_layout || num_layout > 1) &&
+			state->xkb->layout_name) {
+		snprintf(snapshot->layout, sizeof(snapshot->layout), "%s",
+			state->xkb->layout_name);
+	}
+}
 
-		cairo_t *cairo = buffer.cairo;
-		cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
-
-		cairo_save(cairo);
-		cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-		cairo_set_source_u32(cairo, state->args.colors.background);
-		cairo_paint(cairo);
-		if (surface->image && state->args.mode != BACKGROUND_MODE_SOLID_COLOR) {
-			cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
-			render_background_image(cairo, surface->image,
-				state->args.mode, buffer_width, buffer_height);
-		}
-		cairo_restore(cairo);
+static bool snapshot_equal(const struct swaylock_render_snapshot *a,
+		const struct swaylock_render_snapshot *b) {
+	return a->show_indicator == b->show_indicator &&
+		a->auth_state == b->auth_state &&
+		a->input_state == b->input_state &&
+		a->highlight_start == b->highlight_start &&
+		a->failed_attempts == b->failed_attempts &&
+		a->caps_lock == b->caps_lock &&
+		strcmp(a->layout, b->layout) == 0 &&
+		a->width == b->width &&
+		a->height == b->height &&
+		a->scale == b->scale &&
+		a->viewport == b->viewport &&
+		a->subpixel == b->subpixel &&
+		a->transform == b->transform;
+}
+
+static bool transform_swaps_axes(enum wl_output_transform transform) {
+	return transform & WL_OUTPUT_TRANSFORM_90;
+}
+
+/*
+ * Buffers are drawn in the orientation of the output, so that the compositor
+ * doesn't have to rotate them, and given the transform with
+ * wl_surface.set_buffer_transform. This maps the coordinates of a surface
+ * width by height pixels large to those of its buffer.
+ */
+static void get_buffer_matrix(enum wl_output_transform transform,
+		int width, int height, cairo_matrix_t *matrix) {
+	switch (transform) {
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+		cairo_matrix_init_identity(matrix);
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		cairo_matrix_init(matrix, 0, -1, 1, 0, 0, width);
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		cairo_matrix_init(matrix, -1, 0, 0, -1, width, height);
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		cairo_matrix_init(matrix, 0, 1, -1, 0, height, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		cairo_matrix_init(matrix, -1, 0, 0, 1, width, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		cairo_matrix_init(matrix, 0, 1, 1, 0, 0, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		cairo_matrix_init(matrix, 1, 0, 0, -1, 0, height);
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		cairo_matrix_init(matrix, 0, -1, -1, 0, height, width);
+		break;
+	}
+}
+
+bool surface_is_opaque(struct swaylock_surface *surface) {
+	struct swaylock_state *state = surface->state;
+	if ((state->args.colors.background & 0xff) == 0xff) {
+		return true; // painted under everything else
+	}
+	if (!surface->image || state->args.mode == BACKGROUND_MODE_SOLID_COLOR ||
+			state->args.mode == BACKGROUND_MODE_CENTER ||
+			state->args.mode == BACKGROUND_MODE_FIT) {
+		return false;
+	}
+	return cairo_surface_get_content(surface->image) == CAIRO_CONTENT_COLOR;
+}
+
+// The compositor can skip blending surfaces without an alpha channel
+static uint32_t get_background_format(struct swaylock_surface *surface) {
+	struct swaylock_state *state = surface->state;
+	if (!surface_is_opaque(surface)) {
+		return WL_SHM_FORMAT_ARGB8888;
+	}
+	if (state->args.low_memory && state->shm_rgb565) {
+		return WL_SHM_FORMAT_RGB565;
+	}
+	return WL_SHM_FORMAT_XRGB8888;
+}
+
+static void paint_background(struct swaylock_state *state, cairo_t *cairo,
+		cairo_surface_t *image, int buffer_width, int buffer_height) {
+	cairo_save(cairo);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_u32(cairo, state->args.colors.background);
+	cairo_paint(cairo);
+	if (image && state->args.mode != BACKGROUND_MODE_SOLID_COLOR) {
+		cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+		render_background_image(cairo, image,
+			state->args.mode, buffer_width, buffer_height);
+	}
+	cairo_restore(cairo);
+}
+
+// Rows of the full depth background kept around while converting to RGB565
+#define DITHER_STRIP_HEIGHT 64
+
+static const uint8_t dither_matrix[4][4] = {
+	{ 0,  8,  2, 10},
+	{12,  4, 14,  6},
+	{ 3, 11,  1,  9},
+	{15,  7, 13,  5},
+};
+
+// Ordered dithering, which spreads the rounding error over 4x4 blocks so that
+// gradients don't band
+static void dither_row_rgb565(uint16_t *dst, const uint32_t *src, int width,
+		int y) {
+	const uint8_t *threshold = dither_matrix[y & 3];
+	for (int x = 0; x < width; ++x) {
+		// Offset in [0, 255) by which values are rounded up
+		uint32_t bias = (2 * threshold[x & 3] + 1) * 255 / 32;
+		uint32_t r = (((src[x] >> 16) & 0xff) * 31 + bias) / 255;
+		uint32_t g = (((src[x] >> 8) & 0xff) * 63 + bias) / 255;
+		uint32_t b = ((src[x] & 0xff) * 31 + bias) / 255;
+		dst[x] = r << 11 | g << 5 | b;
+	}
+}
+
+// Draws the background a strip at a time, so that a full depth copy of it
+// never exists
+static bool render_background_rgb565(struct swaylock_state *state,
+		cairo_surface_t *image, const cairo_matrix_t *matrix,
+		int surface_width, int surface_height, struct pool_buffer *buffer) {
+	int width = buffer->width, height = buffer->height;
+	int strip_height = height < DITHER_STRIP_HEIGHT ?
+		height : DITHER_STRIP_HEIGHT;
+	cairo_surface_t *strip = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+		width, strip_height);
+	if (cairo_surface_status(strip) != CAIRO_STATUS_SUCCESS) {
+		swaylock_log(LOG_ERROR, "Failed to create background strip.");
+		cairo_surface_destroy(strip);
+		return false;
+	}
+	cairo_t *cairo = cairo_create(strip);
+	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
+	const uint8_t *strip_data = cairo_image_surface_get_data(strip);
+	int strip_stride = cairo_image_surface_get_stride(strip);
+
+	cairo_surface_flush(buffer->surface);
+	for (int y = 0; y < height; y += strip_height) {
 		cairo_identity_matrix(cairo);
+		cairo_translate(cairo, 0, -y);
+		cairo_transform(cairo, matrix);
+		paint_background(state, cairo, image, surface_width, surface_height);
+		cairo_surface_flush(strip);
+
+		int rows = height - y < strip_height ? height - y : strip_height;
+		for (int i = 0; i < rows; ++i) {
+			dither_row_rgb565(
+				(uint16_t *)((uint8_t *)buffer->data +
+					(size_t)(y + i) * buffer->stride),
+				(const uint32_t *)(strip_data + (size_t)i * strip_stride),
+				width, y + i);
+		}
+	}
+	cairo_surface_mark_dirty(buffer->surface);
 
-		wl_surface_attach(surface->surface, buffer.buffer, 0, 0);
-		wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
-		wl_surface_commit(surface->surface);
-		destroy_buffer(&buffer);
+	cairo_destroy(cairo);
+	cairo_surface_destroy(strip);
+	return true;
+}
 
-		surface->last_buffer_width = buffer_width;
-		surface->last_buffer_height = buffer_height;
-	} else {
-		wl_surface_commit(surface->surface);
+static bool render_background(struct swaylock_state *state,
+		cairo_surface_t *image, const struct swaylock_render_snapshot *snapshot,
+		uint32_t format, struct pool_buffer *buffer) {
+	int buffer_width = scale_length(snapshot->width, snapshot->scale);
+	int buffer_height = scale_length(snapshot->height, snapshot->scale);
+	bool swap = transform_swaps_axes(snapshot->transform);
+	if (!alloc_buffer(buffer, swap ? buffer_height : buffer_width,
+			swap ? buffer_width : buffer_height, format)) {
+		swaylock_log(LOG_ERROR,
+			"Failed to create new buffer for frame background.");
+		return false;
+	}
+	cairo_matrix_t matrix;
+	get_buffer_matrix(snapshot->transform, buffer_width, buffer_height,
+		&matrix);
+	if (format == WL_SHM_FORMAT_RGB565) {
+		return render_background_rgb565(state, image, &matrix,
+			buffer_width, buffer_height, buffer);
+	}
+
+	cairo_t *cairo = buffer->cairo;
+	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
+	cairo_set_matrix(cairo, &matrix);
+	paint_background(state, cairo, image, buffer_width, buffer_height);
+	cairo_identity_matrix(cairo);
+	cairo_surface_flush(buffer->surface);
+	return true;
+}
+
+static double get_font_size(struct swaylock_state *state, int arc_radius) {
+	if (state->args.font_size > 0) {
+		return state->args.font_size;
 	}
+	return arc_radius / 3.0f;
 }
 
 static void configure_font_drawing(cairo_t *cairo, struct swaylock_state *state,
@@ -89,19 +327,47 @@ static void configure_font_drawing(cairo_t *cairo, struct swaylock_state *state,
 	cairo_font_options_set_subpixel_order(fo, to_cairo_subpixel_order(subpixel));
 
 	cairo_set_font_options(cairo, fo);
-	cairo_select_font_face(cairo, state->args.font,
-		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	if (state->args.font_size > 0) {
-		cairo_set_font_size(cairo, state->args.font_size);
+	cairo_font_face_t *face = font_get_face(&state->font);
+	if (face) {
+		cairo_set_font_face(cairo, face);
 	} else {
-		cairo_set_font_size(cairo, arc_radius / 3.0f);
+		cairo_select_font_face(cairo, state->args.font,
+			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
 	}
+	cairo_set_font_size(cairo, get_font_size(state, arc_radius));
 	cairo_font_options_destroy(fo);
 }
 
-void render_frame(struct swaylock_surface *surface) {
-	struct swaylock_state *state = surface->state;
+// Text goes through the glyph atlas when there is one and it has all the
+// characters, and through cairo otherwise
+static void get_text_extents(cairo_t *cairo, const struct text_atlas *atlas,
+		const char *text, cairo_text_extents_t *extents) {
+	if (!atlas || !text_atlas_text_extents(atlas, text, extents)) {
+		cairo_text_extents(cairo, text, extents);
+	}
+}
+
+static void get_font_extents(cairo_t *cairo, const struct text_atlas *atlas,
+		cairo_font_extents_t *extents) {
+	if (atlas) {
+		text_atlas_font_extents(atlas, extents);
+	} else {
+		cairo_font_extents(cairo, extents);
+	}
+}
+
+static void show_text(cairo_t *cairo, const struct text_atlas *atlas,
+		double x, double y, const char *text) {
+	if (!atlas || !text_atlas_show_text(atlas, cairo, x, y, text)) {
+		cairo_move_to(cairo, x, y);
+		cairo_show_text(cairo, text);
+	}
+}
 
+static bool render_indicator(struct swaylock_state *state, cairo_t *test_cairo,
+		const struct swaylock_render_snapshot *snapshot,
+		struct pool_buffer *buffer, int *subsurf_x, int *subsurf_y,
+		int *subsurf_width, int *subsurf_height) {
 	// First, compute the text that will be drawn, if any, since this
 	// determines the size/positioning of the surface
 
@@ -109,64 +375,60 @@ void render_frame(struct swaylock_surface *surface) {
 	char *text = NULL;
 	const char *layout_text = NULL;
 
-	bool draw_indicator = state->args.show_indicator &&
-		(state->auth_state != AUTH_STATE_IDLE ||
-			state->input_state != INPUT_STATE_IDLE ||
-			state->args.indicator_idle_visible);
+	bool draw_indicator = snapshot->show_indicator;
 
 	if (draw_indicator) {
-		if (state->input_state == INPUT_STATE_CLEAR) {
+		if (snapshot->input_state == INPUT_STATE_CLEAR) {
 			// This message has highest priority
 			text = "Cleared";
-		} else if (state->auth_state == AUTH_STATE_VALIDATING) {
+		} else if (snapshot->auth_state == AUTH_STATE_VALIDATING) {
 			text = "Verifying";
-		} else if (state->auth_state == AUTH_STATE_INVALID) {
+		} else if (snapshot->auth_state == AUTH_STATE_INVALID) {
 			text = "Wrong";
 		} else {
 			// Caps Lock has higher priority
-			if (state->xkb.caps_lock && state->args.show_caps_lock_text) {
+			if (snapshot->caps_lock && state->args.show_caps_lock_text) {
 				text = "Caps Lock";
 			} else if (state->args.show_failed_attempts &&
-					state->failed_attempts > 0) {
-				if (state->failed_attempts > 999) {
+					snapshot->failed_attempts > 0) {
+				if (snapshot->failed_attempts > 999) {
 					text = "999+";
 				} else {
-					snprintf(attempts, sizeof(attempts), "%d", state->failed_attempts);
+					snprintf(attempts, sizeof(attempts), "%d",
+						snapshot->failed_attempts);
 					text = attempts;
 				}
 			}
 
-			xkb_layout_index_t num_layout = xkb_keymap_num_layouts(state->xkb.keymap);
-			if (!state->args.hide_keyboard_layout &&
-					(state->args.show_keyboard_layout || num_layout > 1)) {
-				xkb_layout_index_t curr_layout = 0;
-
-				// advance to the first active layout (if any)
-				while (curr_layout < num_layout &&
-					xkb_state_layout_index_is_active(state->xkb.state,
-						curr_layout, XKB_STATE_LAYOUT_EFFECTIVE) != 1) {
-					++curr_layout;
-				}
-				// will handle invalid index if none are active
-				layout_text = xkb_keymap_layout_get_name(state->xkb.keymap, curr_layout);
+			if (snapshot->layout[0]) {
+				layout_text = snapshot->layout;
 			}
 		}
 	}
 
 	// Compute the size of the buffer needed
-	int arc_radius = state->args.radius * surface->scale;
-	int arc_thickness = state->args.thickness * surface->scale;
+	double scale = snapshot->scale;
+	int arc_radius = round(state->args.radius * scale);
+	int arc_thickness = round(state->args.thickness * scale);
 	int buffer_diameter = (arc_radius + arc_thickness) * 2;
 	int buffer_width = buffer_diameter;
 	int buffer_height = buffer_diameter;
 
+	// Held until the text is drawn
+	struct text_atlas *atlas = NULL;
+	cairo_font_face_t *face = NULL;
 	if (text || layout_text) {
-		cairo_set_antialias(state->test_cairo, CAIRO_ANTIALIAS_BEST);
-		configure_font_drawing(state->test_cairo, state, surface->subpixel, arc_radius);
+		cairo_set_antialias(test_cairo, CAIRO_ANTIALIAS_BEST);
+		configure_font_drawing(test_cairo, state, snapshot->subpixel, arc_radius);
+		face = font_get_face(&state->font);
+		if (face) {
+			atlas = text_atlas_acquire(&state->text_atlases, face,
+				get_font_size(state, arc_radius));
+		}
 
 		if (text) {
 			cairo_text_extents_t extents;
-			cairo_text_extents(state->test_cairo, text, &extents);
+			get_text_extents(test_cairo, atlas, text, &extents);
 			if (buffer_width < extents.width) {
 				buffer_width = extents.width;
 			}
@@ -174,50 +436,56 @@ void render_frame(struct swaylock_surface *surface) {
 		if (layout_text) {
 			cairo_text_extents_t extents;
 			cairo_font_extents_t fe;
-			double box_padding = 4.0 * surface->scale;
-			cairo_text_extents(state->test_cairo, layout_text, &extents);
-			cairo_font_extents(state->test_cairo, &fe);
+			double box_padding = 4.0 * scale;
+			get_text_extents(test_cairo, atlas, layout_text, &extents);
+			get_font_extents(test_cairo, atlas, &fe);
 			buffer_height += fe.height + 2 * box_padding;
 			if (buffer_width < extents.width + 2 * box_padding) {
 				buffer_width = extents.width + 2 * box_padding;
 			}
 		}
 	}
-	// Ensure buffer size is multiple of buffer scale - required by protocol
-	buffer_height += surface->scale - (buffer_height % surface->scale);
-	buffer_width += surface->scale - (buffer_width % surface->scale);
-
-	int subsurf_xpos;
-	int subsurf_ypos;
+	// The subsurface covers whole surface pixels, which also makes the buffer
+	// size a multiple of an integer buffer scale, as required by the protocol
+	*subsurf_width = ceil(buffer_width / scale);
+	*subsurf_height = ceil(buffer_height / scale);
+	buffer_width = scale_length(*subsurf_width, scale);
+	buffer_height = scale_length(*subsurf_height, scale);
 
 	// Center the indicator unless overridden by the user
 	if (state->args.override_indicator_x_position) {
-		subsurf_xpos = state->args.indicator_x_position -
-			buffer_width / (2 * surface->scale) + 2 / surface->scale;
+		*subsurf_x = state->args.indicator_x_position -
+			*subsurf_width / 2 + (int)(2 / scale);
 	} else {
-		subsurf_xpos = surface->width / 2 -
-			buffer_width / (2 * surface->scale) + 2 / surface->scale;
+		*subsurf_x = snapshot->width / 2 -
+			*subsurf_width / 2 + (int)(2 / scale);
 	}
 
 	if (state->args.override_indicator_y_position) {
-		subsurf_ypos = state->args.indicator_y_position -
+		*subsurf_y = state->args.indicator_y_position -
 			(state->args.radius + state->args.thickness);
 	} else {
-		subsurf_ypos = surface->height / 2 -
+		*subsurf_y = snapshot->height / 2 -
 			(state->args.radius + state->args.thickness);
 	}
 
-	struct pool_buffer *buffer = get_next_buffer(state->shm,
-			surface->indicator_buffers, buffer_width, buffer_height);
-	if (buffer == NULL) {
-		return;
+	bool swap = transform_swaps_axes(snapshot->transform);
+	if (!alloc_buffer(buffer, swap ? buffer_height : buffer_width,
+			swap ? buffer_width : buffer_height, WL_SHM_FORMAT_ARGB8888)) {
+		if (face) {
+			text_atlas_release(&state->text_atlases);
+		}
+		return false;
 	}
 
 	// Render the buffer
 	cairo_t *cairo = buffer->cairo;
 	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
 
-	cairo_identity_matrix(cairo);
+	cairo_matrix_t matrix;
+	get_buffer_matrix(snapshot->transform, buffer_width, buffer_height,
+		&matrix);
+	cairo_set_matrix(cairo, &matrix);
 
 	// Clear
 	cairo_save(cairo);
@@ -227,99 +495,109 @@ void render_frame(struct swaylock_surface *surface) {
 	cairo_restore(cairo);
 
 	float type_indicator_border_thickness =
-		TYPE_INDICATOR_BORDER_THICKNESS * surface->scale;
+		TYPE_INDICATOR_BORDER_THICKNESS * scale;
 
 	if (draw_indicator) {
+		// The circles are drawn straight into the buffer, cairo only
+		// draws the text
+		struct ring_raster_target ring = {
+			.data = buffer->data,
+			.width = buffer->width,
+			.height = buffer->height,
+			.stride = buffer->stride,
+		};
+		double center_x = buffer_width / 2, center_y = buffer_diameter / 2;
+		cairo_matrix_transform_point(&matrix, &center_x, &center_y);
+		double inner_radius = arc_radius - arc_thickness / 2;
+		double outer_radius = arc_radius + arc_thickness / 2;
+		double ring_inner = arc_radius - arc_thickness / 2.0;
+		double ring_outer = arc_radius + arc_thickness / 2.0;
+		cairo_surface_flush(buffer->surface);
+
 		// Fill inner circle
-		cairo_set_line_width(cairo, 0);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-				arc_radius - arc_thickness / 2, 0, 2 * M_PI);
-		set_color_for_state(cairo, state, &state->args.colors.inside);
-		cairo_fill_preserve(cairo);
-		cairo_stroke(cairo);
+		ring_raster_annulus(&ring, center_x, center_y, 0, inner_radius,
+			get_color_for_state(state, snapshot, &state->args.colors.inside));
 
 		// Draw ring
-		cairo_set_line_width(cairo, arc_thickness);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2, arc_radius,
-				0, 2 * M_PI);
-		set_color_for_state(cairo, state, &state->args.colors.ring);
-		cairo_stroke(cairo);
+		ring_raster_annulus(&ring, center_x, center_y, ring_inner, ring_outer,
+			get_color_for_state(state, snapshot, &state->args.colors.ring));
+		cairo_surface_mark_dirty(buffer->surface);
 
 		// Draw a message
-		configure_font_drawing(cairo, state, surface->subpixel, arc_radius);
-		set_color_for_state(cairo, state, &state->args.colors.text);
+		configure_font_drawing(cairo, state, snapshot->subpixel, arc_radius);
+		set_color_for_state(cairo, state, snapshot, &state->args.colors.text);
 
 		if (text) {
 			cairo_text_extents_t extents;
 			cairo_font_extents_t fe;
 			double x, y;
-			cairo_text_extents(cairo, text, &extents);
-			cairo_font_extents(cairo, &fe);
+			get_text_extents(cairo, atlas, text, &extents);
+			get_font_extents(cairo, atlas, &fe);
 			x = (buffer_width / 2) -
 				(extents.width / 2 + extents.x_bearing);
 			y = (buffer_diameter / 2) +
 				(fe.height / 2 - fe.descent);
 
-			cairo_move_to(cairo, x, y);
-			cairo_show_text(cairo, text);
+			show_text(cairo, atlas, x, y, text);
 			cairo_close_path(cairo);
 			cairo_new_sub_path(cairo);
 		}
+		cairo_surface_flush(buffer->surface);
 
 		// Typing indicator: Highlight random part on keypress
-		if (state->input_state == INPUT_STATE_LETTER ||
-				state->input_state == INPUT_STATE_BACKSPACE) {
-			double highlight_start = state->highlight_start * (M_PI / 1024.0);
-			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-					arc_radius, highlight_start,
-					highlight_start + TYPE_INDICATOR_RANGE);
-			if (state->input_state == INPUT_STATE_LETTER) {
-				if (state->xkb.caps_lock && state->args.show_caps_lock_indicator) {
-					cairo_set_source_u32(cairo, state->args.colors.caps_lock_key_highlight);
+		if (snapshot->input_state == INPUT_STATE_LETTER ||
+				snapshot->input_state == INPUT_STATE_BACKSPACE) {
+			double highlight_start = snapshot->highlight_start * (M_PI / 1024.0);
+			uint32_t highlight_color;
+			if (snapshot->input_state == INPUT_STATE_LETTER) {
+				if (snapshot->caps_lock && state->args.show_caps_lock_indicator) {
+					highlight_color = state->args.colors.caps_lock_key_highlight;
 				} else {
-					cairo_set_source_u32(cairo, state->args.colors.key_highlight);
+					highlight_color = state->args.colors.key_highlight;
 				}
 			} else {
-				if (state->xkb.caps_lock && state->args.show_caps_lock_indicator) {
-					cairo_set_source_u32(cairo, state->args.colors.caps_lock_bs_highlight);
+				if (snapshot->caps_lock && state->args.show_caps_lock_indicator) {
+					highlight_color = state->args.colors.caps_lock_bs_highlight;
 				} else {
-					cairo_set_source_u32(cairo, state->args.colors.bs_highlight);
+					highlight_color = state->args.colors.bs_highlight;
 				}
 			}
-			cairo_stroke(cairo);
+			ring_raster_arc_transformed(&ring, &matrix, center_x, center_y,
+				ring_inner, ring_outer,
+				highlight_start, highlight_start + TYPE_INDICATOR_RANGE,
+				highlight_color);
 
 			// Draw borders
-			cairo_set_source_u32(cairo, state->args.colors.separator);
-			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-					arc_radius, highlight_start,
-					highlight_start + type_indicator_border_thickness);
-			cairo_stroke(cairo);
-
-			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-					arc_radius, highlight_start + TYPE_INDICATOR_RANGE,
-					highlight_start + TYPE_INDICATOR_RANGE +
-						type_indicator_border_thickness);
-			cairo_stroke(cairo);
+			ring_raster_arc_transformed(&ring, &matrix, center_x, center_y,
+				ring_inner, ring_outer,
+				highlight_start,
+				highlight_start + type_indicator_border_thickness,
+				state->args.colors.separator);
+			ring_raster_arc_transformed(&ring, &matrix, center_x, center_y,
+				ring_inner, ring_outer,
+				highlight_start + TYPE_INDICATOR_RANGE,
+				highlight_start + TYPE_INDICATOR_RANGE +
+					type_indicator_border_thickness,
+				state->args.colors.separator);
 		}
 
 		// Draw inner + outer border of the circle
-		set_color_for_state(cairo, state, &state->args.colors.line);
-		cairo_set_line_width(cairo, 2.0 * surface->scale);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-				arc_radius - arc_thickness / 2, 0, 2 * M_PI);
-		cairo_stroke(cairo);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-				arc_radius + arc_thickness / 2, 0, 2 * M_PI);
-		cairo_stroke(cairo);
+		uint32_t line_color =
+			get_color_for_state(state, snapshot, &state->args.colors.line);
+		ring_raster_annulus(&ring, center_x, center_y,
+			inner_radius - scale, inner_radius + scale, line_color);
+		ring_raster_annulus(&ring, center_x, center_y,
+			outer_radius - scale, outer_radius + scale, line_color);
+		cairo_surface_mark_dirty(buffer->surface);
 
 		// display layout text separately
 		if (layout_text) {
 			cairo_text_extents_t extents;
 			cairo_font_extents_t fe;
 			double x, y;
-			double box_padding = 4.0 * surface->scale;
-			cairo_text_extents(cairo, layout_text, &extents);
-			cairo_font_extents(cairo, &fe);
+			double box_padding = 4.0 * scale;
+			get_text_extents(cairo, atlas, layout_text, &extents);
+			get_font_extents(cairo, atlas, &fe);
 			// upper left coordinates for box
 			x = (buffer_width / 2) - (extents.width / 2) - box_padding;
 			y = buffer_diameter;
@@ -335,22 +613,155 @@ void render_frame(struct swaylock_surface *surface) {
 			cairo_stroke(cairo);
 
 			// take font extents and padding into account
-			cairo_move_to(cairo,
-				x - extents.x_bearing + box_padding,
-				y + (fe.height - fe.descent) + box_padding);
 			cairo_set_source_u32(cairo, state->args.colors.layout_text);
-			cairo_show_text(cairo, layout_text);
+			show_text(cairo, atlas,
+				x - extents.x_bearing + box_padding,
+				y + (fe.height - fe.descent) + box_padding, layout_text);
 			cairo_new_sub_path(cairo);
 		}
 	}
+	if (face) {
+		text_atlas_release(&state->text_atlases);
+	}
+
+	cairo_surface_flush(buffer->surface);
+	return true;
+}
+
+void render_job_prepare(struct swaylock_surface *surface,
+		struct swaylock_render_job *job, bool background, bool indicator) {
+	*job = (struct swaylock_render_job){
+		.surface = surface,
+		.image = surface->image,
+		.background_format = get_background_format(surface),
+	};
+	take_render_snapshot(surface, &job->snapshot);
+	job->indicator = indicator && !(surface->last_snapshot_valid &&
+		snapshot_equal(&job->snapshot, &surface->last_snapshot));
+
+	double scale = get_surface_scale(surface);
+	int buffer_width = scale_length(surface->width, scale);
+	int buffer_height = scale_length(surface->height, scale);
+	job->background = background &&
+		(buffer_width != surface->last_buffer_width ||
+			buffer_height != surface->last_buffer_height ||
+			surface->transform != surface->last_buffer_transform);
+
+	if (job->indicator) {
+		// Owned by the job until it's presented or dropped
+		job->indicator_buffer = get_free_buffer(surface->indicator_buffers);
+		if (job->indicator_buffer) {
+			job->indicator_buffer->busy = true;
+		}
+	}
+}
+
+void render_job_run(struct swaylock_state *state,
+		struct swaylock_render_job *job, cairo_t *test_cairo) {
+	if (job->background) {
+		job->background_ok = render_background(state, job->image,
+			&job->snapshot, job->background_format, &job->background_buffer);
+	}
+	if (job->indicator_buffer) {
+		job->indicator_ok = render_indicator(state, test_cairo,
+			&job->snapshot, job->indicator_buffer,
+			&job->subsurf_x, &job->subsurf_y,
+			&job->subsurf_width, &job->subsurf_height);
+	}
+}
+
+static void render_job_drop(struct swaylock_render_job *job) {
+	destroy_buffer(&job->background_buffer);
+	if (job->indicator_buffer) {
+		job->indicator_buffer->busy = false;
+		job->indicator_buffer = NULL;
+	}
+}
+
+// Tells the compositor how large the surface is in surface pixels, given
+// buffers drawn for the snapshot's scale
+static void set_buffer_size(struct wl_surface *wl_surface,
+		struct wp_viewport *viewport,
+		const struct swaylock_render_snapshot *snapshot,
+		int width, int height) {
+	if (snapshot->viewport) {
+		wl_surface_set_buffer_scale(wl_surface, 1);
+		wp_viewport_set_destination(viewport, width, height);
+	} else {
+		wl_surface_set_buffer_scale(wl_surface, (int32_t)snapshot->scale);
+	}
+}
+
+bool render_job_present(struct swaylock_render_job *job) {
+	struct swaylock_surface *surface = job->surface;
+	struct swaylock_state *state = surface->state;
+	const struct swaylock_render_snapshot *snapshot = &job->snapshot;
+
+	if (snapshot->width != surface->width ||
+			snapshot->height != surface->height ||
+			snapshot->scale != get_surface_scale(surface) ||
+			snapshot->viewport != uses_viewport(surface)) {
+		// Reconfigured while rendering, the buffers have the wrong size
+		render_job_drop(job);
+		return false;
+	}
 
 	// Send Wayland requests
-	wl_subsurface_set_position(surface->subsurface, subsurf_xpos, subsurf_ypos);
+	set_buffer_size(surface->surface, surface->viewport, snapshot,
+		snapshot->width, snapshot->height);
+
+	if (job->background_ok &&
+			export_buffer(state->shm, &job->background_buffer)) {
+		wl_surface_set_buffer_transform(surface->surface, snapshot->transform);
+		wl_surface_attach(surface->surface,
+			job->background_buffer.buffer, 0, 0);
+		wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
+		surface->last_buffer_width =
+			scale_length(snapshot->width, snapshot->scale);
+		surface->last_buffer_height =
+			scale_length(snapshot->height, snapshot->scale);
+		surface->last_buffer_transform = snapshot->transform;
+	}
 
-	wl_surface_set_buffer_scale(surface->child, surface->scale);
-	wl_surface_attach(surface->child, buffer->buffer, 0, 0);
-	wl_surface_damage_buffer(surface->child, 0, 0, INT32_MAX, INT32_MAX);
-	wl_surface_commit(surface->child);
+	struct pool_buffer *buffer = job->indicator_buffer;
+	if (job->indicator_ok && export_buffer(state->shm, buffer)) {
+		wl_subsurface_set_position(surface->subsurface,
+			job->subsurf_x, job->subsurf_y);
+
+		set_buffer_size(surface->child, surface->child_viewport, snapshot,
+			job->subsurf_width, job->subsurf_height);
+		wl_surface_set_buffer_transform(surface->child, snapshot->transform);
+		wl_surface_attach(surface->child, buffer->buffer, 0, 0);
+		wl_surface_damage_buffer(surface->child, 0, 0, INT32_MAX, INT32_MAX);
+		wl_surface_commit(surface->child);
+		surface->last_snapshot = *snapshot;
+		surface->last_snapshot_valid = true;
+	} else if (buffer) {
+		buffer->busy = false;
+	}
 
 	wl_surface_commit(surface->surface);
+
+	// The background buffer is only used once
+	destroy_buffer(&job->background_buffer);
+	return true;
+}
+
+void render_frame_background(struct swaylock_surface *surface) {
+	if (surface->width == 0 || surface->height == 0) {
+		return; // not yet configured
+	}
+	struct swaylock_render_job job;
+	render_job_prepare(surface, &job, true, false);
+	render_job_run(surface->state, &job, surface->state->test_cairo);
+	render_job_present(&job);
+}
+
+void render_frame(struct swaylock_surface *surface) {
+	// Always drawn, eg. in response to a configure
+	surface->last_snapshot_valid = false;
+	struct swaylock_render_job job;
+	render_job_prepare(surface, &job, false, true);
+	render_job_run(surface->state, &job, surface->state->test_cairo);
+	render_job_present(&job);
 }
@@ -0,0 +1,365 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ring-raster.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define RING_PI 3.14159265358979323846
+
+// Components of the unit normal of an edge, a the larger one
+struct edge_normal {
+	float a, b;
+};
+
+// How far from the center of a pixel an edge can still cover some of it
+#define RING_REACH 0.70710678f
+
+// Keeps the division in edge_coverage() well conditioned. Rounding the
+// ramp of axis aligned edges that little is worth well under a unit.
+#define RING_MIN_NORMAL (1.0f / 64.0f)
+
+struct ring_shape {
+	float cx, cy;
+	float r0, r1;
+	bool arc;
+	float sin0, cos0, sin1, cos1; // of the start and end angles
+	struct edge_normal normal0, normal1; // of the start and end edges
+	uint32_t color; // premultiplied, native ARGB32
+};
+
+static inline uint32_t div255(uint32_t x) {
+	// x / 255 rounded, for x <= 255 * 255
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static uint32_t premultiply(uint32_t rgba) {
+	uint32_t a = rgba & 0xFF;
+	return a << 24 |
+		div255((rgba >> 24 & 0xFF) * a) << 16 |
+		div255((rgba >> 16 & 0xFF) * a) << 8 |
+		div255((rgba >> 8 & 0xFF) * a);
+}
+
+static inline float clamp01(float v) {
+	return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+static struct edge_normal get_edge_normal(float x, float y) {
+	x = fabsf(x);
+	y = fabsf(y);
+	return (struct edge_normal){
+		// At least sqrt(1/2) for a unit vector, also away from the center
+		.a = fmaxf(fmaxf(x, y), RING_REACH),
+		.b = fmaxf(fminf(x, y), RING_MIN_NORMAL),
+	};
+}
+
+static inline float square_positive(float x) {
+	return x > 0.0f ? x * x : 0.0f;
+}
+
+// Area of the pixel on the inner side of a straight edge which passes at
+// distance s from its center. It grows quadratically while the edge crosses
+// the first and last corners, and linearly in between.
+static inline float edge_coverage(float s, struct edge_normal n) {
+	// Clamped first, far away the squares would cancel out imprecisely
+	s = s < -RING_REACH ? -RING_REACH : (s > RING_REACH ? RING_REACH : s);
+	float u = s + 0.5f * (n.a + n.b);
+	float area = square_positive(u) - square_positive(u - n.a) -
+		square_positive(u - n.b) + square_positive(u - n.a - n.b);
+	return clamp01(area / (2.0f * n.a * n.b));
+}
+
+// Coverage of a pixel is computed from the distance of its center to each
+// edge, as if the edge was straight there, which is close for curves which
+// are large compared to a pixel. Opposite edges closer than a pixel add up,
+// so thin rings and arcs still get the right amount of ink.
+static inline uint32_t pixel_coverage(const struct ring_shape *s,
+		float px, float py2, float py_cos0, float py_cos1) {
+	float d = sqrtf(px * px + py2);
+	float c = 1.0f;
+	if (s->r1 - d < RING_REACH || d - s->r0 < RING_REACH) {
+		// Along the circles, whose normal points to the center
+		float inv_d = 1.0f / (d + 1e-6f);
+		struct edge_normal n =
+			get_edge_normal(px * inv_d, sqrtf(py2) * inv_d);
+		c = clamp01(edge_coverage(s->r1 - d, n) +
+			edge_coverage(d - s->r0, n) - 1.0f);
+	}
+	if (s->arc) {
+		float d0 = py_cos0 - px * s->sin0;
+		float d1 = py_cos1 - px * s->sin1;
+		c = c * clamp01(edge_coverage(d0, s->normal0) +
+			edge_coverage(-d1, s->normal1) - 1.0f);
+	}
+	return (uint32_t)(c * 255.0f + 0.5f);
+}
+
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t src, uint32_t cov) {
+	uint32_t sa = div255((src >> 24) * cov);
+	uint32_t out = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t s = div255((src >> shift & 0xFF) * cov);
+		uint32_t d = dst >> shift & 0xFF;
+		out |= (s + div255(d * (255 - sa))) << shift;
+	}
+	return out;
+}
+
+#ifdef __SSE2__
+static inline __m128i div255_epi16(__m128i x) {
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Two pixels, one channel per 16 bit lane
+static inline __m128i blend_pixels(__m128i dst, __m128i src, __m128i cov) {
+	__m128i s = div255_epi16(_mm_mullo_epi16(src, cov));
+	__m128i sa = _mm_shufflehi_epi16(
+		_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)),
+		_MM_SHUFFLE(3, 3, 3, 3));
+	__m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), sa);
+	return _mm_add_epi16(s, div255_epi16(_mm_mullo_epi16(dst, inv)));
+}
+
+static inline __m128 clamp01_ps(__m128 v) {
+	return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+static inline __m128 square_positive_ps(__m128 x) {
+	x = _mm_max_ps(x, _mm_setzero_ps());
+	return _mm_mul_ps(x, x);
+}
+
+// Same as edge_coverage(), inv_2ab being 1 / (2 * a * b)
+static inline __m128 edge_coverage_ps(__m128 s, __m128 a, __m128 b,
+		__m128 inv_2ab) {
+	const __m128 reach = _mm_set1_ps(RING_REACH);
+	s = _mm_min_ps(_mm_max_ps(s, _mm_sub_ps(_mm_setzero_ps(), reach)), reach);
+	__m128 u = _mm_add_ps(s, _mm_mul_ps(_mm_add_ps(a, b), _mm_set1_ps(0.5f)));
+	__m128 ua = _mm_sub_ps(u, a);
+	__m128 area = _mm_sub_ps(square_positive_ps(u), square_positive_ps(ua));
+	area = _mm_sub_ps(area, square_positive_ps(_mm_sub_ps(u, b)));
+	area = _mm_add_ps(area, square_positive_ps(_mm_sub_ps(ua, b)));
+	return clamp01_ps(_mm_mul_ps(area, inv_2ab));
+}
+
+static int fill_span_sse2(const struct ring_shape *s, uint32_t *row,
+		int x, int end, float py2, float py_cos0, float py_cos1) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 reach = _mm_set1_ps(RING_REACH);
+	const __m128 min_normal = _mm_set1_ps(RING_MIN_NORMAL);
+	const __m128 r1 = _mm_set1_ps(s->r1), r0 = _mm_set1_ps(s->r0);
+	const __m128 vpy2 = _mm_set1_ps(py2);
+	const __m128 abs_py = _mm_set1_ps(sqrtf(py2));
+	const __m128 sin0 = _mm_set1_ps(s->sin0), sin1 = _mm_set1_ps(s->sin1);
+	const __m128 vpy_cos0 = _mm_set1_ps(py_cos0);
+	const __m128 vpy_cos1 = _mm_set1_ps(py_cos1);
+	const __m128 a0 = _mm_set1_ps(s->normal0.a), b0 = _mm_set1_ps(s->normal0.b);
+	const __m128 a1 = _mm_set1_ps(s->normal1.a), b1 = _mm_set1_ps(s->normal1.b);
+	const __m128 inv_2ab0 =
+		_mm_set1_ps(1.0f / (2.0f * s->normal0.a * s->normal0.b));
+	const __m128 inv_2ab1 =
+		_mm_set1_ps(1.0f / (2.0f * s->normal1.a * s->normal1.b));
+	const __m128 offset = _mm_set1_ps(0.5f - s->cx);
+	const __m128i src = _mm_unpacklo_epi8(
+		_mm_set1_epi32((int32_t)s->color), _mm_setzero_si128());
+
+	for (; x + 4 <= end; x += 4) {
+		__m128 px = _mm_add_ps(_mm_cvtepi32_ps(
+			_mm_setr_epi32(x, x + 1, x + 2, x + 3)), offset);
+		__m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(px, px), vpy2));
+		__m128 to_outer = _mm_sub_ps(r1, d), to_inner = _mm_sub_ps(d, r0);
+		__m128 c = one;
+		if (_mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(to_outer, reach),
+				_mm_cmplt_ps(to_inner, reach)))) {
+			// The approximate reciprocals are plenty for the slope of the
+			// coverage ramps
+			__m128 inv_d = _mm_rcp_ps(_mm_add_ps(d, _mm_set1_ps(1e-6f)));
+			__m128 nx = _mm_mul_ps(_mm_max_ps(px, _mm_sub_ps(_mm_setzero_ps(),
+				px)), inv_d);
+			__m128 ny = _mm_mul_ps(abs_py, inv_d);
+			__m128 a = _mm_max_ps(_mm_max_ps(nx, ny), reach);
+			__m128 b = _mm_max_ps(_mm_min_ps(nx, ny), min_normal);
+			__m128 inv_2ab = _mm_rcp_ps(_mm_mul_ps(_mm_add_ps(a, a), b));
+			c = clamp01_ps(_mm_sub_ps(_mm_add_ps(
+				edge_coverage_ps(to_outer, a, b, inv_2ab),
+				edge_coverage_ps(to_inner, a, b, inv_2ab)), one));
+		}
+		if (s->arc) {
+			__m128 d0 = _mm_sub_ps(vpy_cos0, _mm_mul_ps(px, sin0));
+			__m128 d1 = _mm_sub_ps(_mm_mul_ps(px, sin1), vpy_cos1);
+			__m128 e = clamp01_ps(_mm_sub_ps(_mm_add_ps(
+				edge_coverage_ps(d0, a0, b0, inv_2ab0),
+				edge_coverage_ps(d1, a1, b1, inv_2ab1)), one));
+			c = _mm_mul_ps(c, e);
+		}
+		__m128i cov = _mm_cvttps_epi32(_mm_add_ps(
+			_mm_mul_ps(c, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(cov, _mm_setzero_si128())) ==
+				0xFFFF) {
+			continue;
+		}
+
+		__m128i c16 = _mm_packs_epi32(cov, cov);
+		c16 = _mm_unpacklo_epi16(c16, c16);
+		__m128i *p = (__m128i *)&row[x];
+		__m128i dst = _mm_loadu_si128(p);
+		__m128i lo = blend_pixels(_mm_unpacklo_epi8(dst, _mm_setzero_si128()),
+			src, _mm_unpacklo_epi32(c16, c16));
+		__m128i hi = blend_pixels(_mm_unpackhi_epi8(dst, _mm_setzero_si128()),
+			src, _mm_unpackhi_epi32(c16, c16));
+		_mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+	}
+	return x;
+}
+#endif
+
+static void fill_span(const struct ring_shape *s, uint32_t *row,
+		int x, int end, float py) {
+	float py2 = py * py;
+	float py_cos0 = py * s->cos0, py_cos1 = py * s->cos1;
+#ifdef __SSE2__
+	x = fill_span_sse2(s, row, x, end, py2, py_cos0, py_cos1);
+#endif
+	for (; x < end; ++x) {
+		float px = (float)x + (0.5f - s->cx);
+		uint32_t cov = pixel_coverage(s, px, py2, py_cos0, py_cos1);
+		if (cov) {
+			row[x] = blend_pixel(row[x], s->color, cov);
+		}
+	}
+}
+
+static void include_point(double x, double y, double bounds[static 4]) {
+	bounds[0] = x < bounds[0] ? x : bounds[0];
+	bounds[1] = y < bounds[1] ? y : bounds[1];
+	bounds[2] = x > bounds[2] ? x : bounds[2];
+	bounds[3] = y > bounds[3] ? y : bounds[3];
+}
+
+// Bounds of an arc relative to its center: its corners, and the points of
+// the outer circle at right angles which it goes through
+static void get_arc_bounds(double r0, double r1, double start, double end,
+		double bounds[static 4]) {
+	bounds[0] = bounds[1] = INFINITY;
+	bounds[2] = bounds[3] = -INFINITY;
+	double angles[] = { start, end };
+	for (int i = 0; i < 2; ++i) {
+		include_point(r0 * cos(angles[i]), r0 * sin(angles[i]), bounds);
+		include_point(r1 * cos(angles[i]), r1 * sin(angles[i]), bounds);
+	}
+	static const int dirs[4][2] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
+	for (double k = ceil(start / (RING_PI / 2)); k * (RING_PI / 2) <= end; ++k) {
+		int dir = (int)fmod(fmod(k, 4) + 4, 4);
+		include_point(r1 * dirs[dir][0], r1 * dirs[dir][1], bounds);
+	}
+}
+
+static void fill_shape(const struct ring_raster_target *target,
+		const struct ring_shape *s, const double bounds[static 4]) {
+	// Pixels whose center is within half a diagonal of the shape
+	int y0 = floor(s->cy + bounds[1] - RING_REACH);
+	int y1 = ceil(s->cy + bounds[3] + RING_REACH);
+	int x0 = floor(s->cx + bounds[0] - RING_REACH);
+	int x1 = ceil(s->cx + bounds[2] + RING_REACH);
+	y0 = y0 < 0 ? 0 : y0;
+	x0 = x0 < 0 ? 0 : x0;
+	y1 = y1 > target->height ? target->height : y1;
+	x1 = x1 > target->width ? target->width : x1;
+
+	float outer = s->r1 + RING_REACH, inner = s->r0 - RING_REACH;
+	for (int y = y0; y < y1; ++y) {
+		float py = (float)y + (0.5f - s->cy);
+		if (fabsf(py) >= outer) {
+			continue;
+		}
+		uint32_t *row = (uint32_t *)((uint8_t *)target->data +
+			(size_t)y * target->stride);
+
+		// Only the pixels from the outer circle to the inner one, on
+		// either side, can be covered
+		float w = sqrtf(outer * outer - py * py);
+		int start = floor(s->cx - w - 0.5f), end = ceil(s->cx + w + 0.5f);
+		start = start < x0 ? x0 : start;
+		end = end > x1 ? x1 : end;
+		if (inner > 0 && fabsf(py) < inner) {
+			float h = sqrtf(inner * inner - py * py);
+			int hole_start = ceil(s->cx - h + 0.5f);
+			int hole_end = floor(s->cx + h - 1.5f);
+			if (hole_start < hole_end) {
+				fill_span(s, row, start,
+					hole_start < end ? hole_start : end, py);
+				start = hole_end > start ? hole_end : start;
+			}
+		}
+		fill_span(s, row, start, end, py);
+	}
+}
+
+void ring_raster_annulus(const struct ring_raster_target *target,
+		double cx, double cy, double r0, double r1, uint32_t color) {
+	struct ring_shape s = {
+		.cx = cx,
+		.cy = cy,
+		// Far enough inside that the center pixel is fully covered
+		.r0 = r0 > 0 ? r0 : -1,
+		.r1 = r1,
+		.color = premultiply(color),
+	};
+	if (r1 <= 0 || !(color & 0xFF)) {
+		return;
+	}
+	double bounds[4] = { -r1, -r1, r1, r1 };
+	fill_shape(target, &s, bounds);
+}
+
+void ring_raster_arc(const struct ring_raster_target *target,
+		double cx, double cy, double r0, double r1,
+		double start, double end, uint32_t color) {
+	struct ring_shape s = {
+		.cx = cx,
+		.cy = cy,
+		.r0 = r0 > 0 ? r0 : -1,
+		.r1 = r1,
+		.arc = true,
+		.sin0 = sin(start),
+		.cos0 = cos(start),
+		.sin1 = sin(end),
+		.cos1 = cos(end),
+		.normal0 = get_edge_normal(sin(start), cos(start)),
+		.normal1 = get_edge_normal(sin(end), cos(end)),
+		.color = premultiply(color),
+	};
+	if (r1 <= 0 || end <= start || !(color & 0xFF)) {
+		return;
+	}
+	double bounds[4];
+	get_arc_bounds(r0 > 0 ? r0 : 0, r1, start, end, bounds);
+	fill_shape(target, &s, bounds);
+}
+
+void ring_raster_arc_transformed(const struct ring_raster_target *target,
+		const cairo_matrix_t *matrix, double cx, double cy, double r0,
+		double r1, double start, double end, uint32_t color) {
+	double x0 = cos(start), y0 = sin(start);
+	double x1 = cos(end), y1 = sin(end);
+	cairo_matrix_transform_distance(matrix, &x0, &y0);
+	cairo_matrix_transform_distance(matrix, &x1, &y1);
+	start = atan2(y0, x0);
+	end = atan2(y1, x1);
+	if (matrix->xx * matrix->yy - matrix->xy * matrix->yx < 0) {
+		// Mirrored, the arc now runs the other way
+		double tmp = start;
+		start = end;
+		end = tmp;
+	}
+	if (end < start) {
+		end += 2 * RING_PI;
+	}
+	ring_raster_arc(target, cx, cy, r0, r1, start, end, color);
+}
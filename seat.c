@@ -1,13 +1,31 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
+#include "keymap-cache.h"
 #include "log.h"
 #include "swaylock.h"
 #include "seat.h"
 #include "loop.h"
 
+static void update_layout_name(struct swaylock_xkb *xkb) {
+	xkb_layout_index_t num_layout = xkb_keymap_num_layouts(xkb->keymap);
+	xkb_layout_index_t curr_layout = 0;
+
+	// advance to the first active layout (if any)
+	while (curr_layout < num_layout &&
+		xkb_state_layout_index_is_active(xkb->state,
+			curr_layout, XKB_STATE_LAYOUT_EFFECTIVE) != 1) {
+		++curr_layout;
+	}
+	// will handle invalid index if none are active
+	xkb->layout_name = xkb_keymap_layout_get_name(xkb->keymap, curr_layout);
+}
+
 static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
 		uint32_t format, int32_t fd, uint32_t size) {
 	struct swaylock_seat *seat = data;
@@ -23,18 +41,30 @@ static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
 		swaylock_log(LOG_ERROR, "Unable to initialize keymap shm, aborting");
 		exit(1);
 	}
-	struct xkb_keymap *keymap = xkb_keymap_new_from_buffer(
-			state->xkb.context, map_shm, size - 1, XKB_KEYMAP_FORMAT_TEXT_V1,
-			XKB_KEYMAP_COMPILE_NO_FLAGS);
+	struct xkb_keymap *keymap = keymap_cache_get(&state->keymap_cache,
+		state->xkb_context, map_shm, size - 1);
 	munmap(map_shm, size - 1);
 	close(fd);
 	assert(keymap);
+	if (keymap == seat->xkb.keymap) {
+		// Sent again, keep the current state
+		xkb_keymap_unref(keymap);
+		return;
+	}
 	struct xkb_state *xkb_state = xkb_state_new(keymap);
 	assert(xkb_state);
-	xkb_keymap_unref(state->xkb.keymap);
-	xkb_state_unref(state->xkb.state);
-	state->xkb.keymap = keymap;
-	state->xkb.state = xkb_state;
+	xkb_keymap_unref(seat->xkb.keymap);
+	xkb_state_unref(seat->xkb.state);
+	seat->xkb.keymap = keymap;
+	seat->xkb.state = xkb_state;
+	update_layout_name(&seat->xkb);
+	seat->xkb.caps_lock = false;
+	seat->xkb.control = false;
+	if (!state->xkb) {
+		state->xkb = &seat->xkb;
+	} else if (state->xkb == &seat->xkb) {
+		damage_state(state);
+	}
 }
 
 static void keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
@@ -47,12 +77,60 @@ static void keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
 	// Who cares
 }
 
+// Repeats which were missed for longer than this, eg. across a suspend, are
+// dropped rather than replayed
+#define REPEAT_MAX_CATCH_UP_MS 1000
+
+static int64_t timespec_to_ns(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void schedule_repeat(struct swaylock_seat *seat) {
+	// Repeat n is due at a fixed offset from the first one, so a late wakeup
+	// doesn't push back the ones after it. Rounded up so that it is never
+	// considered due before its time.
+	int64_t ns = timespec_to_ns(&seat->repeat_start) +
+		((int64_t)seat->repeat_count * 1000000000 + seat->repeat_rate - 1) /
+			seat->repeat_rate;
+	struct timespec expiry = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+	loop_timer_arm_at(seat->state->eventloop, &seat->repeat_timer, &expiry);
+}
+
 static void keyboard_repeat(void *data) {
 	struct swaylock_seat *seat = data;
 	struct swaylock_state *state = seat->state;
-	seat->repeat_timer = loop_add_timer(
-		state->eventloop, seat->repeat_period_ms, keyboard_repeat, seat);
-	swaylock_handle_key(state, seat->repeat_sym, seat->repeat_codepoint);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	int64_t elapsed_ns = timespec_to_ns(&now) -
+		timespec_to_ns(&seat->repeat_start);
+	uint64_t due = elapsed_ns < 0 ? 0 :
+		(uint64_t)(elapsed_ns * seat->repeat_rate / 1000000000) + 1;
+	uint64_t missed = due > seat->repeat_count ? due - seat->repeat_count : 0;
+	if (missed > (uint64_t)seat->repeat_rate * REPEAT_MAX_CATCH_UP_MS / 1000) {
+		swaylock_log(LOG_DEBUG, "Dropping %" PRIu64 " key repeats after a "
+			"stall", missed - 1);
+		seat->repeat_start = now;
+		seat->repeat_count = 0;
+		missed = 1;
+	}
+
+	// Everything which was due since the last wakeup goes into the password
+	// at once. Rendering waits for the next frame anyway, so the batch only
+	// costs one redraw.
+	for (uint64_t i = 0; i < missed; ++i) {
+		swaylock_handle_key(state, &seat->xkb, seat->repeat_sym,
+			seat->repeat_codepoint);
+	}
+	if (missed > 1) {
+		swaylock_log(LOG_DEBUG, "Caught up on %" PRIu64 " key repeats",
+			missed);
+	}
+	seat->repeat_count += missed;
+	schedule_repeat(seat);
 }
 
 static void keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
@@ -60,24 +138,31 @@ static void keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
 	struct swaylock_seat *seat = data;
 	struct swaylock_state *state = seat->state;
 	enum wl_keyboard_key_state key_state = _key_state;
-	xkb_keysym_t sym = xkb_state_key_get_one_sym(state->xkb.state, key + 8);
+	if (seat->xkb.state == NULL) {
+		return;
+	}
+	xkb_keysym_t sym = xkb_state_key_get_one_sym(seat->xkb.state, key + 8);
 	uint32_t keycode = key_state == WL_KEYBOARD_KEY_STATE_PRESSED ?
 		key + 8 : 0;
-	uint32_t codepoint = xkb_state_key_get_utf32(state->xkb.state, keycode);
+	uint32_t codepoint = xkb_state_key_get_utf32(seat->xkb.state, keycode);
 	if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-		swaylock_handle_key(state, sym, codepoint);
+		// The indicator follows whoever is typing
+		state->xkb = &seat->xkb;
+		swaylock_handle_key(state, &seat->xkb, sym, codepoint);
 	}
 
-	if (seat->repeat_timer) {
-		loop_remove_timer(seat->state->eventloop, seat->repeat_timer);
-		seat->repeat_timer = NULL;
-	}
+	loop_timer_disarm(seat->state->eventloop, &seat->repeat_timer);
 
-	if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED && seat->repeat_period_ms > 0) {
+	if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED && seat->repeat_rate > 0) {
 		seat->repeat_sym = sym;
 		seat->repeat_codepoint = codepoint;
-		seat->repeat_timer = loop_add_timer(
-			seat->state->eventloop, seat->repeat_delay_ms, keyboard_repeat, seat);
+		clock_gettime(CLOCK_MONOTONIC, &seat->repeat_start);
+		int64_t ns = timespec_to_ns(&seat->repeat_start) +
+			(int64_t)seat->repeat_delay_ms * 1000000;
+		seat->repeat_start.tv_sec = ns / 1000000000;
+		seat->repeat_start.tv_nsec = ns % 1000000000;
+		seat->repeat_count = 0;
+		schedule_repeat(seat);
 	}
 }
 
@@ -86,24 +171,32 @@ static void keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
 		uint32_t mods_locked, uint32_t group) {
 	struct swaylock_seat *seat = data;
 	struct swaylock_state *state = seat->state;
-	if (state->xkb.state == NULL) {
+	struct swaylock_xkb *xkb = &seat->xkb;
+	if (xkb->state == NULL) {
 		return;
 	}
 
-	int layout_same = xkb_state_layout_index_is_active(state->xkb.state,
+	// Only the seat shown by the indicator needs a redraw
+	bool shown = state->xkb == xkb;
+	int layout_same = xkb_state_layout_index_is_active(xkb->state,
 		group, XKB_STATE_LAYOUT_EFFECTIVE);
-	if (!layout_same) {
+	if (!layout_same && shown) {
 		damage_state(state);
 	}
-	xkb_state_update_mask(state->xkb.state,
+	xkb_state_update_mask(xkb->state,
 		mods_depressed, mods_latched, mods_locked, 0, 0, group);
-	int caps_lock = xkb_state_mod_name_is_active(state->xkb.state,
+	if (!layout_same) {
+		update_layout_name(xkb);
+	}
+	int caps_lock = xkb_state_mod_name_is_active(xkb->state,
 		XKB_MOD_NAME_CAPS, XKB_STATE_MODS_LOCKED);
-	if (caps_lock != state->xkb.caps_lock) {
-		state->xkb.caps_lock = caps_lock;
-		damage_state(state);
+	if (caps_lock != xkb->caps_lock) {
+		xkb->caps_lock = caps_lock;
+		if (shown) {
+			damage_state(state);
+		}
 	}
-	state->xkb.control = xkb_state_mod_name_is_active(state->xkb.state,
+	xkb->control = xkb_state_mod_name_is_active(xkb->state,
 		XKB_MOD_NAME_CTRL,
 		XKB_STATE_MODS_DEPRESSED | XKB_STATE_MODS_LATCHED);
 }
@@ -111,13 +204,8 @@ static void keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
 static void keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
 		int32_t rate, int32_t delay) {
 	struct swaylock_seat *seat = data;
-	if (rate <= 0) {
-		seat->repeat_period_ms = -1;
-	} else {
-		// Keys per second -> milliseconds between keys
-		seat->repeat_period_ms = 1000 / rate;
-	}
-	seat->repeat_delay_ms = delay;
+	seat->repeat_rate = rate > 0 ? rate : 0;
+	seat->repeat_delay_ms = delay > 0 ? delay : 0;
 }
 
 static const struct wl_keyboard_listener keyboard_listener = {
@@ -196,6 +284,7 @@ static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
 	if (seat->keyboard) {
 		wl_keyboard_release(seat->keyboard);
 		seat->keyboard = NULL;
+		loop_timer_disarm(seat->state->eventloop, &seat->repeat_timer);
 	}
 	if ((caps & WL_SEAT_CAPABILITY_POINTER)) {
 		seat->pointer = wl_seat_get_pointer(wl_seat);
@@ -203,6 +292,7 @@ static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
 	}
 	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD)) {
 		seat->keyboard = wl_seat_get_keyboard(wl_seat);
+		loop_timer_init(&seat->repeat_timer, keyboard_repeat, seat);
 		wl_keyboard_add_listener(seat->keyboard, &keyboard_listener, seat);
 	}
 }
@@ -1,21 +1,17 @@
-#define _XOPEN_SOURCE // for crypt
-#include <assert.h>
+#define _XOPEN_SOURCE 700 // for getspnam
 #include <pwd.h>
 #include <shadow.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
-#ifdef __GLIBC__
-// GNU, you damn slimy bastard
-#include <crypt.h>
-#endif
 #include "comm.h"
 #include "log.h"
 #include "password-buffer.h"
 #include "swaylock.h"
 
-char *encpw = NULL;
+const uint32_t pw_backend_fail_delay_ms = 2000;
 
 void initialize_pw_backend(int argc, char **argv) {
 	/* This code runs as root */
@@ -24,7 +20,7 @@ void initialize_pw_backend(int argc, char **argv) {
 		swaylock_log_errno(LOG_ERROR, "failed to getpwuid");
 		exit(EXIT_FAILURE);
 	}
-	encpw = pwent->pw_passwd;
+	char *encpw = pwent->pw_passwd;
 	if (strcmp(encpw, "x") == 0) {
 		struct spwd *swent = getspnam(pwent->pw_name);
 		if (!swent) {
@@ -51,43 +47,11 @@ void initialize_pw_backend(int argc, char **argv) {
 	/* This code does not run as root */
 	swaylock_log(LOG_DEBUG, "Prepared to authorize user %s", pwent->pw_name);
 
-	if (!spawn_comm_child()) {
+	// swaylock-auth isn't setuid, it gets the hash from us
+	if (!spawn_comm_child() || !write_comm_password_hash(encpw)) {
 		exit(EXIT_FAILURE);
 	}
 
-	/* Buffer is only used by the child */
 	clear_buffer(encpw, strlen(encpw));
 	encpw = NULL;
 }
-
-void run_pw_backend_child(void) {
-	assert(encpw != NULL);
-	while (1) {
-		char *buf;
-		ssize_t size = read_comm_request(&buf);
-		if (size < 0) {
-			exit(EXIT_FAILURE);
-		} else if (size == 0) {
-			break;
-		}
-
-		const char *c = crypt(buf, encpw);
-		password_buffer_destroy(buf, size);
-		buf = NULL;
-
-		if (c == NULL) {
-			swaylock_log_errno(LOG_ERROR, "crypt failed");
-			exit(EXIT_FAILURE);
-		}
-		bool success = strcmp(c, encpw) == 0;
-
-		if (!write_comm_reply(success)) {
-			exit(EXIT_FAILURE);
-		}
-
-		sleep(2);
-	}
-
-	clear_buffer(encpw, strlen(encpw));
-	exit(EXIT_SUCCESS);
-}
@@ -0,0 +1,297 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+#include "text-atlas.h"
+
+#define ATLAS_FIRST_CHAR 0x20
+#define ATLAS_LAST_CHAR 0x7e
+#define ATLAS_CHARS (ATLAS_LAST_CHAR - ATLAS_FIRST_CHAR + 1)
+#define ATLAS_COLUMNS 16
+// Keeps the antialiased edges of neighbouring glyphs apart
+#define ATLAS_PADDING 1
+
+struct atlas_glyph {
+	cairo_text_extents_t extents;
+	int origin_x, origin_y; // of the glyph, relative to its cell
+	bool ink; // false for blanks, which are never drawn
+};
+
+struct text_atlas {
+	cairo_font_face_t *face;
+	double size;
+	cairo_font_extents_t font_extents;
+	cairo_surface_t *surface; // A8, one cell per glyph
+	int cell_width, cell_height;
+	struct atlas_glyph glyphs[ATLAS_CHARS];
+	bool failed; // kept in the cache so that it isn't built again
+};
+
+static void text_atlas_destroy(struct text_atlas *atlas) {
+	if (!atlas) {
+		return;
+	}
+	cairo_surface_destroy(atlas->surface);
+	cairo_font_face_destroy(atlas->face);
+	free(atlas);
+}
+
+static cairo_scaled_font_t *create_scaled_font(cairo_font_face_t *face,
+		double size) {
+	// Same hinting as text drawn through cairo. Subpixel antialiasing would
+	// need a mask per color channel, which an A8 atlas can't hold.
+	cairo_font_options_t *fo = cairo_font_options_create();
+	cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_FULL);
+	cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_GRAY);
+	cairo_matrix_t font_matrix, ctm;
+	cairo_matrix_init_scale(&font_matrix, size, size);
+	cairo_matrix_init_identity(&ctm);
+	cairo_scaled_font_t *scaled =
+		cairo_scaled_font_create(face, &font_matrix, &ctm, fo);
+	cairo_font_options_destroy(fo);
+	return scaled;
+}
+
+// Looks up the glyph of every character, and sizes the cells to fit the
+// largest one
+static bool load_glyphs(struct text_atlas *atlas, cairo_scaled_font_t *scaled,
+		cairo_glyph_t *glyphs) {
+	for (int i = 0; i < ATLAS_CHARS; ++i) {
+		char utf8[2] = { ATLAS_FIRST_CHAR + i, '\0' };
+		cairo_glyph_t *glyph = &glyphs[i];
+		int num_glyphs = 1;
+		cairo_status_t status = cairo_scaled_font_text_to_glyphs(scaled,
+			0, 0, utf8, 1, &glyph, &num_glyphs, NULL, NULL, NULL);
+		// More than one glyph for the character wouldn't fit the buffer
+		bool single = glyph == &glyphs[i] && num_glyphs == 1;
+		if (glyph != &glyphs[i]) {
+			cairo_glyph_free(glyph);
+		}
+		if (status != CAIRO_STATUS_SUCCESS || !single) {
+			swaylock_log(LOG_ERROR, "Unable to map '%s' to a glyph", utf8);
+			return false;
+		}
+
+		struct atlas_glyph *g = &atlas->glyphs[i];
+		cairo_scaled_font_glyph_extents(scaled, &glyphs[i], 1, &g->extents);
+		g->ink = g->extents.width > 0 && g->extents.height > 0;
+		if (!g->ink) {
+			continue;
+		}
+		int left = floor(g->extents.x_bearing);
+		int top = floor(g->extents.y_bearing);
+		int right = ceil(g->extents.x_bearing + g->extents.width);
+		int bottom = ceil(g->extents.y_bearing + g->extents.height);
+		g->origin_x = ATLAS_PADDING - left;
+		g->origin_y = ATLAS_PADDING - top;
+		if (atlas->cell_width < right - left + 2 * ATLAS_PADDING) {
+			atlas->cell_width = right - left + 2 * ATLAS_PADDING;
+		}
+		if (atlas->cell_height < bottom - top + 2 * ATLAS_PADDING) {
+			atlas->cell_height = bottom - top + 2 * ATLAS_PADDING;
+		}
+	}
+	return true;
+}
+
+static struct text_atlas *text_atlas_create(cairo_font_face_t *face,
+		double size) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct text_atlas *atlas = calloc(1, sizeof(*atlas));
+	if (!atlas) {
+		swaylock_log(LOG_ERROR, "Unable to allocate text atlas");
+		return NULL;
+	}
+	atlas->face = cairo_font_face_reference(face);
+	atlas->size = size;
+
+	cairo_scaled_font_t *scaled = create_scaled_font(face, size);
+	cairo_status_t status = cairo_scaled_font_status(scaled);
+	if (status != CAIRO_STATUS_SUCCESS) {
+		swaylock_log(LOG_ERROR, "Unable to scale font for the text atlas: %s",
+			cairo_status_to_string(status));
+		goto error;
+	}
+	cairo_scaled_font_extents(scaled, &atlas->font_extents);
+
+	cairo_glyph_t glyphs[ATLAS_CHARS];
+	if (!load_glyphs(atlas, scaled, glyphs)) {
+		goto error;
+	}
+	int rows = (ATLAS_CHARS + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+	atlas->surface = cairo_image_surface_create(CAIRO_FORMAT_A8,
+		ATLAS_COLUMNS * atlas->cell_width + 1, rows * atlas->cell_height + 1);
+	status = cairo_surface_status(atlas->surface);
+	if (status != CAIRO_STATUS_SUCCESS) {
+		swaylock_log(LOG_ERROR, "Unable to create text atlas: %s",
+			cairo_status_to_string(status));
+		goto error;
+	}
+
+	cairo_t *cairo = cairo_create(atlas->surface);
+	cairo_set_scaled_font(cairo, scaled);
+	for (int i = 0; i < ATLAS_CHARS; ++i) {
+		struct atlas_glyph *g = &atlas->glyphs[i];
+		if (!g->ink) {
+			continue;
+		}
+		glyphs[i].x = (i % ATLAS_COLUMNS) * atlas->cell_width + g->origin_x;
+		glyphs[i].y = (i / ATLAS_COLUMNS) * atlas->cell_height + g->origin_y;
+		cairo_show_glyphs(cairo, &glyphs[i], 1);
+	}
+	cairo_destroy(cairo);
+	cairo_surface_flush(atlas->surface);
+	cairo_scaled_font_destroy(scaled);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	swaylock_log(LOG_DEBUG, "Built %.1f px text atlas (%dx%d) in %.1f ms",
+		size, cairo_image_surface_get_width(atlas->surface),
+		cairo_image_surface_get_height(atlas->surface),
+		(end.tv_sec - start.tv_sec) * 1000.0 +
+		(end.tv_nsec - start.tv_nsec) / 1000000.0);
+	return atlas;
+
+error:
+	cairo_scaled_font_destroy(scaled);
+	cairo_surface_destroy(atlas->surface);
+	atlas->surface = NULL;
+	atlas->failed = true;
+	return atlas;
+}
+
+void text_atlas_cache_init(struct text_atlas_cache *cache) {
+	*cache = (struct text_atlas_cache){0};
+	pthread_mutex_init(&cache->lock, NULL);
+}
+
+void text_atlas_cache_finish(struct text_atlas_cache *cache) {
+	for (int i = 0; i < TEXT_ATLAS_CACHE_SIZE; ++i) {
+		text_atlas_destroy(cache->atlases[i]);
+		cache->atlases[i] = NULL;
+	}
+	pthread_mutex_destroy(&cache->lock);
+}
+
+struct text_atlas *text_atlas_acquire(struct text_atlas_cache *cache,
+		cairo_font_face_t *face, double size) {
+	pthread_mutex_lock(&cache->lock);
+
+	int found = -1, used = 0;
+	for (; used < TEXT_ATLAS_CACHE_SIZE && cache->atlases[used]; ++used) {
+		if (cache->atlases[used]->face == face &&
+				cache->atlases[used]->size == size) {
+			found = used;
+		}
+	}
+	struct text_atlas *atlas;
+	if (found >= 0) {
+		atlas = cache->atlases[found];
+	} else {
+		atlas = text_atlas_create(face, size);
+		if (!atlas) {
+			return NULL;
+		}
+		if (used == TEXT_ATLAS_CACHE_SIZE) {
+			// Evict the least recently used one
+			text_atlas_destroy(cache->atlases[--used]);
+		}
+		found = used;
+	}
+	memmove(&cache->atlases[1], &cache->atlases[0],
+		found * sizeof(*cache->atlases));
+	cache->atlases[0] = atlas;
+	return atlas->failed ? NULL : atlas;
+}
+
+void text_atlas_release(struct text_atlas_cache *cache) {
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void text_atlas_font_extents(const struct text_atlas *atlas,
+		cairo_font_extents_t *extents) {
+	*extents = atlas->font_extents;
+}
+
+static bool in_atlas(const char *text) {
+	for (; *text; ++text) {
+		unsigned char c = *text;
+		if (c < ATLAS_FIRST_CHAR || c > ATLAS_LAST_CHAR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static const struct atlas_glyph *get_glyph(const struct text_atlas *atlas,
+		char c) {
+	return &atlas->glyphs[(unsigned char)c - ATLAS_FIRST_CHAR];
+}
+
+bool text_atlas_text_extents(const struct text_atlas *atlas, const char *text,
+		cairo_text_extents_t *extents) {
+	if (!in_atlas(text)) {
+		return false;
+	}
+	double pen = 0, left = 0, right = 0, top = 0, bottom = 0;
+	bool ink = false;
+	for (const char *c = text; *c; ++c) {
+		const struct atlas_glyph *g = get_glyph(atlas, *c);
+		if (g->ink) {
+			double l = pen + g->extents.x_bearing;
+			double r = l + g->extents.width;
+			double t = g->extents.y_bearing;
+			double b = t + g->extents.height;
+			left = ink && left < l ? left : l;
+			right = ink && right > r ? right : r;
+			top = ink && top < t ? top : t;
+			bottom = ink && bottom > b ? bottom : b;
+			ink = true;
+		}
+		pen += g->extents.x_advance;
+	}
+	*extents = (cairo_text_extents_t){
+		.x_bearing = left,
+		.y_bearing = top,
+		.width = right - left,
+		.height = bottom - top,
+		.x_advance = pen,
+		.y_advance = 0,
+	};
+	return true;
+}
+
+bool text_atlas_show_text(const struct text_atlas *atlas, cairo_t *cairo,
+		double x, double y, const char *text) {
+	if (!in_atlas(text)) {
+		return false;
+	}
+	cairo_new_path(cairo);
+	double pen_x = x;
+	int pen_y = round(y);
+	for (const char *c = text; *c; ++c) {
+		const struct atlas_glyph *g = get_glyph(atlas, *c);
+		if (g->ink) {
+			int i = (unsigned char)*c - ATLAS_FIRST_CHAR;
+			int cell_x = (i % ATLAS_COLUMNS) * atlas->cell_width;
+			int cell_y = (i / ATLAS_COLUMNS) * atlas->cell_height;
+			// Where the cell lands, glyphs are only ever drawn on whole
+			// pixels so that the atlas is never resampled
+			int dest_x = (int)round(pen_x) - g->origin_x;
+			int dest_y = pen_y - g->origin_y;
+
+			cairo_save(cairo);
+			cairo_rectangle(cairo, dest_x, dest_y,
+				atlas->cell_width, atlas->cell_height);
+			cairo_clip(cairo);
+			cairo_mask_surface(cairo, atlas->surface,
+				dest_x - cell_x, dest_y - cell_y);
+			cairo_restore(cairo);
+		}
+		pen_x += g->extents.x_advance;
+	}
+	return true;
+}